@@ -127,12 +127,12 @@ build() {
   cd "$ROOT_DIR"
 
   "$CXX" -std=c++20 \
-    src/main.cpp src/control-catalogue.cpp src/command-database.cpp src/packet-assembler.cpp src/usb-send.cpp \
+    src/main.cpp src/control-catalogue.cpp src/catalogue-snapshot.cpp src/catalogue-sqlite.cpp src/command-database.cpp src/embedded-catalogue.cpp src/packet-assembler.cpp src/usb-send.cpp \
     -o sanbot-mcu-bridge \
     $(pkg-config --cflags --libs sqlite3 libusb-1.0)
 
   "$CXX" -std=c++20 \
-    src/command-database-smoke.cpp src/control-catalogue.cpp src/command-database.cpp src/packet-assembler.cpp \
+    src/command-database-smoke.cpp src/control-catalogue.cpp src/catalogue-snapshot.cpp src/catalogue-sqlite.cpp src/command-database.cpp src/embedded-catalogue.cpp src/packet-assembler.cpp \
     -o sanbot-command-db-smoke \
     $(pkg-config --cflags --libs sqlite3)
 
@@ -0,0 +1,162 @@
+#include "byte-sum.h"
+
+#include <array>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define SANBOT_BYTE_SUM_X86 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define SANBOT_BYTE_SUM_NEON 1
+#elif defined(__arm__) && defined(__linux__) &&                               \
+    (defined(__ARM_NEON) || (defined(__ARM_FP) && !defined(__clang__)))
+// 32-bit ARM: Raspberry Pi OS builds without -mfpu=neon, so the NEON kernel
+// is compiled for NEON on its own and used only if the CPU reports it. GCC's
+// arm_neon.h enables NEON for its intrinsics itself on hard-float builds.
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#define SANBOT_BYTE_SUM_NEON 1
+#define SANBOT_BYTE_SUM_NEON_HWCAP 1
+#endif
+
+#if SANBOT_BYTE_SUM_NEON_HWCAP && !defined(__ARM_NEON)
+#define SANBOT_NEON_TARGET __attribute__((target("fpu=neon")))
+#else
+#define SANBOT_NEON_TARGET
+#endif
+
+namespace {
+
+uint32_t sumPortable(const uint8_t *data, std::size_t size) {
+  uint32_t sum = 0;
+  for (std::size_t i = 0; i < size; ++i)
+    sum += data[i];
+  return sum;
+}
+
+#if SANBOT_BYTE_SUM_X86
+
+// psadbw against zero adds each group of eight bytes into a 64-bit lane, so
+// the accumulators cannot overflow for any buffer that fits in memory.
+__attribute__((target("sse2"))) uint32_t sumSse2(const uint8_t *data,
+                                                 std::size_t size) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i acc = zero;
+  std::size_t i = 0;
+  for (; i + 64 <= size; i += 64) {
+    const __m128i *p = reinterpret_cast<const __m128i *>(data + i);
+    __m128i a = _mm_add_epi64(_mm_sad_epu8(_mm_loadu_si128(p), zero),
+                              _mm_sad_epu8(_mm_loadu_si128(p + 1), zero));
+    __m128i b = _mm_add_epi64(_mm_sad_epu8(_mm_loadu_si128(p + 2), zero),
+                              _mm_sad_epu8(_mm_loadu_si128(p + 3), zero));
+    acc = _mm_add_epi64(acc, _mm_add_epi64(a, b));
+  }
+  for (; i + 16 <= size; i += 16) {
+    const __m128i *p = reinterpret_cast<const __m128i *>(data + i);
+    acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_loadu_si128(p), zero));
+  }
+  uint64_t sum = static_cast<uint64_t>(_mm_cvtsi128_si64(acc)) +
+                 static_cast<uint64_t>(
+                     _mm_cvtsi128_si64(_mm_unpackhi_epi64(acc, acc)));
+  return static_cast<uint32_t>(sum) + sumPortable(data + i, size - i);
+}
+
+__attribute__((target("avx2"))) uint32_t sumAvx2(const uint8_t *data,
+                                                 std::size_t size) {
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i acc = zero;
+  std::size_t i = 0;
+  for (; i + 128 <= size; i += 128) {
+    const __m256i *p = reinterpret_cast<const __m256i *>(data + i);
+    __m256i a =
+        _mm256_add_epi64(_mm256_sad_epu8(_mm256_loadu_si256(p), zero),
+                         _mm256_sad_epu8(_mm256_loadu_si256(p + 1), zero));
+    __m256i b =
+        _mm256_add_epi64(_mm256_sad_epu8(_mm256_loadu_si256(p + 2), zero),
+                         _mm256_sad_epu8(_mm256_loadu_si256(p + 3), zero));
+    acc = _mm256_add_epi64(acc, _mm256_add_epi64(a, b));
+  }
+  for (; i + 32 <= size; i += 32) {
+    const __m256i *p = reinterpret_cast<const __m256i *>(data + i);
+    acc = _mm256_add_epi64(acc, _mm256_sad_epu8(_mm256_loadu_si256(p), zero));
+  }
+  // The tail stays in this function: handing it to the SSE2 kernel would mix
+  // legacy SSE code with dirty upper halves, which stalls on every call.
+  __m128i half = _mm_add_epi64(_mm256_castsi256_si128(acc),
+                               _mm256_extracti128_si256(acc, 1));
+  for (; i + 16 <= size; i += 16) {
+    const __m128i *p = reinterpret_cast<const __m128i *>(data + i);
+    half = _mm_add_epi64(half, _mm_sad_epu8(_mm_loadu_si128(p),
+                                            _mm_setzero_si128()));
+  }
+  uint64_t sum = static_cast<uint64_t>(_mm_cvtsi128_si64(half)) +
+                 static_cast<uint64_t>(
+                     _mm_cvtsi128_si64(_mm_unpackhi_epi64(half, half)));
+  return static_cast<uint32_t>(sum) + sumPortable(data + i, size - i);
+}
+
+#elif SANBOT_BYTE_SUM_NEON
+
+// Pairwise widening adds: two blocks of bytes into 16-bit lanes (at most
+// 1020 each), then into 32-bit lanes, which wrap as the returned sum does.
+SANBOT_NEON_TARGET uint32_t sumNeon(const uint8_t *data, std::size_t size) {
+  uint32x4_t acc = vdupq_n_u32(0);
+  std::size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    uint16x8_t pairs = vpaddlq_u8(vld1q_u8(data + i));
+    pairs = vpadalq_u8(pairs, vld1q_u8(data + i + 16));
+    acc = vpadalq_u16(acc, pairs);
+  }
+  for (; i + 16 <= size; i += 16)
+    acc = vpadalq_u16(acc, vpaddlq_u8(vld1q_u8(data + i)));
+  uint32_t sum = vgetq_lane_u32(acc, 0) + vgetq_lane_u32(acc, 1) +
+                 vgetq_lane_u32(acc, 2) + vgetq_lane_u32(acc, 3);
+  return sum + sumPortable(data + i, size - i);
+}
+
+#endif
+
+struct KernelList {
+  std::array<ByteSumKernel, 3> kernels;
+  std::size_t count = 0;
+
+  void add(ByteSumKernel kernel) { kernels[count++] = kernel; }
+};
+
+const KernelList &kernelList() {
+  static const KernelList list = [] {
+    KernelList out;
+    out.add({"portable", sumPortable});
+#if SANBOT_BYTE_SUM_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+      out.add({"sse2", sumSse2});
+    if (__builtin_cpu_supports("avx2"))
+      out.add({"avx2", sumAvx2});
+#elif SANBOT_BYTE_SUM_NEON
+#if SANBOT_BYTE_SUM_NEON_HWCAP
+    // HWCAP_NEON in the 32-bit ARM Linux hwcaps.
+    constexpr unsigned long kHwcapNeon = 1ul << 12;
+    if (getauxval(AT_HWCAP) & kHwcapNeon)
+      out.add({"neon", sumNeon});
+#else
+    out.add({"neon", sumNeon});
+#endif
+#endif
+    return out;
+  }();
+  return list;
+}
+
+} // namespace
+
+const ByteSumKernel &byteSumKernel() {
+  static const ByteSumKernel &selected =
+      kernelList().kernels[kernelList().count - 1];
+  return selected;
+}
+
+std::span<const ByteSumKernel> availableByteSumKernels() {
+  const KernelList &list = kernelList();
+  return std::span<const ByteSumKernel>(list.kernels.data(), list.count);
+}
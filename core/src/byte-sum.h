@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+// Sums of byte buffers, the core of the USB frame checksum. Each kernel
+// returns the plain sum of the bytes modulo 2^32; callers keep the low byte.
+// The widest kernel the CPU supports is picked once, on first use.
+struct ByteSumKernel {
+  const char *name;
+  uint32_t (*sum)(const uint8_t *data, std::size_t size);
+};
+
+// The selected kernel.
+const ByteSumKernel &byteSumKernel();
+
+// Every kernel this build and CPU can run, portable first.
+std::span<const ByteSumKernel> availableByteSumKernels();
+
+inline uint32_t sumBytes(std::span<const uint8_t> data) {
+  return byteSumKernel().sum(data.data(), data.size());
+}
@@ -0,0 +1,231 @@
+#include "command-database.h"
+
+#include <cstdio>
+#include <exception>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <type_traits>
+
+// Build-time generator for sanbot-catalogue-data.h: loads the SQLite catalogue,
+// compiles it exactly as CommandDatabase does at runtime and writes the
+// resulting tables out as constexpr arrays.
+
+using namespace sanbot;
+
+namespace {
+
+void write(std::ostream &out, uint8_t value) { out << unsigned(value); }
+void write(std::ostream &out, uint32_t value) { out << value << "u"; }
+void write(std::ostream &out, int32_t value) { out << value; }
+void write(std::ostream &out, bool value) { out << (value ? "true" : "false"); }
+
+void write(std::ostream &out, TextRef ref) {
+  out << "{" << ref.offset << "u, " << ref.length << "u}";
+}
+
+void write(std::ostream &out, PlanRange range) {
+  out << "{" << range.begin << "u, " << range.count << "u}";
+}
+
+template <typename Enum>
+void writeEnum(std::ostream &out, const char *type, Enum value) {
+  out << "static_cast<" << type << ">(" << unsigned(value) << ")";
+}
+
+void write(std::ostream &out, const PlanTerm &r);
+
+template <typename... Fields>
+void writeFields(std::ostream &out, const Fields &...fields) {
+  out << "{";
+  const char *separator = "";
+  ((out << separator, write(out, fields), separator = ", "), ...);
+  out << "}";
+}
+
+void write(std::ostream &out, const CommandRecord &r) {
+  writeFields(out, r.commandId, r.canonicalName, r.commandGroup,
+              r.commandModeHex, r.ackDefaultHex, r.targetName, r.routeTagHex,
+              r.routeHandling, r.payloadTemplate, r.description, r.aliases,
+              r.parameters);
+}
+
+void write(std::ostream &out, const ParameterRecord &r) {
+  writeFields(out, r.ordinal, r.payloadOffset, r.fieldName, r.fieldRole,
+              r.valueExpr, r.valueHex, r.conditionExpr, r.description,
+              r.omitIfMinusOne, r.valueAliases);
+}
+
+void write(std::ostream &out, const ValueAliasRecord &r) {
+  writeFields(out, r.name, r.value);
+}
+
+void write(std::ostream &out, const AliasRecord &r) {
+  writeFields(out, r.key, r.command, r.candidates);
+}
+
+void write(std::ostream &out, const PlanName &r) {
+  writeFields(out, r.contextSlot, r.aliasParameter, r.keys, r.text);
+}
+
+void write(std::ostream &out, const PlanCondition &r) {
+  out << "{";
+  writeEnum(out, "ConditionOp", r.op);
+  out << ", ";
+  write(out, r.name);
+  out << ", ";
+  write(out, r.values);
+  out << ", ";
+  write(out, r.message);
+  out << "}";
+}
+
+void write(std::ostream &out, const PlanTerm &r) {
+  out << "{";
+  writeEnum(out, "TermKind", r.kind);
+  out << ", ";
+  write(out, r.value);
+  out << ", ";
+  write(out, r.name);
+  out << ", ";
+  write(out, r.text);
+  out << "}";
+}
+
+void write(std::ostream &out, const FieldPlan &r) {
+  out << "{";
+  writeEnum(out, "FieldOp", r.op);
+  out << ", ";
+  write(out, r.constant);
+  out << ", ";
+  write(out, r.lowByte);
+  out << ", ";
+  write(out, r.parameter);
+  out << ", ";
+  write(out, r.condition);
+  out << ", ";
+  write(out, r.select);
+  out << ", ";
+  writeFields(out, r.rememberSlots[0], r.rememberSlots[1]);
+  out << ", ";
+  writeFields(out, r.terms[0], r.terms[1]);
+  out << ", ";
+  write(out, r.keys);
+  out << ", ";
+  write(out, r.halfKeys);
+  out << ", ";
+  write(out, r.name);
+  out << ", ";
+  write(out, r.message);
+  out << "}";
+}
+
+void write(std::ostream &out, const CommandPlan &r) {
+  writeFields(out, r.commandMode, r.ackFlag, r.hasRouteTag, r.routeTag,
+              r.commandModeSlot, r.contextSlots, r.fields, r.argumentKeys,
+              r.message);
+}
+
+template <typename T> const char *typeName();
+template <> const char *typeName<CommandRecord>() { return "CommandRecord"; }
+template <> const char *typeName<ParameterRecord>() { return "ParameterRecord"; }
+template <> const char *typeName<ValueAliasRecord>() {
+  return "ValueAliasRecord";
+}
+template <> const char *typeName<TextRef>() { return "TextRef"; }
+template <> const char *typeName<AliasRecord>() { return "AliasRecord"; }
+template <> const char *typeName<uint32_t>() { return "uint32_t"; }
+template <> const char *typeName<CommandPlan>() { return "CommandPlan"; }
+template <> const char *typeName<FieldPlan>() { return "FieldPlan"; }
+template <> const char *typeName<PlanCondition>() { return "PlanCondition"; }
+template <> const char *typeName<PlanName>() { return "PlanName"; }
+template <> const char *typeName<uint8_t>() { return "uint8_t"; }
+
+template <typename T>
+void writeTable(std::ostream &out, const char *name, std::span<const T> rows) {
+  out << "inline constexpr std::array<" << typeName<T>() << ", " << rows.size()
+      << "> " << name << "{{\n";
+  for (const auto &row : rows) {
+    out << "    ";
+    write(out, row);
+    out << ",\n";
+  }
+  out << "}};\n\n";
+}
+
+void writeTable(std::ostream &out, const char *name,
+                std::span<const char> text) {
+  out << "inline constexpr char " << name << "[" << text.size() + 1
+      << "] =\n    \"";
+  std::size_t column = 0;
+  for (char c : text) {
+    unsigned char byte = static_cast<unsigned char>(c);
+    if (byte == '"' || byte == '\\') {
+      out << '\\' << c;
+    } else if (byte >= 0x20 && byte < 0x7F && byte != '?') {
+      out << c;
+    } else {
+      char escaped[8];
+      std::snprintf(escaped, sizeof(escaped), "\\%03o", byte);
+      out << escaped;
+    }
+    if (++column == 72) {
+      out << "\"\n    \"";
+      column = 0;
+    }
+  }
+  out << "\";\n\n";
+}
+
+std::string generateHeader(const CommandDatabase &db) {
+  const CatalogueTables &tables = db.tables();
+  std::ostringstream out;
+  out << "// Generated by sanbot-catalogue-gen; do not edit.\n"
+         "#pragma once\n\n"
+         "#include \"catalogue-tables.h\"\n\n"
+         "#include <array>\n#include <cstdint>\n\n"
+         "namespace sanbot::generated {\n\n";
+
+  forEachCatalogueTable(tables, [&](const char *name, const auto &table) {
+    writeTable(out, name, table);
+  });
+
+  out << "constexpr CatalogueTables catalogueTables() {\n"
+         "  CatalogueTables tables;\n";
+  forEachCatalogueTable(tables, [&](const char *name, const auto &table) {
+    if constexpr (std::is_same_v<std::decay_t<decltype(table)>,
+                                 std::span<const char>>)
+      out << "  tables." << name << " = {" << name << ", " << table.size()
+          << "};\n";
+    else
+      out << "  tables." << name << " = " << name << ";\n";
+  });
+  out << "  return tables;\n}\n\n"
+         "static_assert(commands.size() == plans.size());\n\n"
+         "} // namespace sanbot::generated\n";
+  return out.str();
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  if (argc != 3) {
+    std::fprintf(stderr, "Usage: %s DATABASE OUTPUT_HEADER\n", argv[0]);
+    return 2;
+  }
+
+  try {
+    CommandDatabase db(argv[1], SnapshotPolicy::Ignore);
+    std::string header = generateHeader(db);
+
+    std::ofstream out(argv[2], std::ios::binary | std::ios::trunc);
+    if (!out || !(out << header) || !out.flush()) {
+      std::fprintf(stderr, "failed to write %s\n", argv[2]);
+      return 1;
+    }
+    return 0;
+  } catch (const std::exception &ex) {
+    std::fprintf(stderr, "catalogue generation failed: %s\n", ex.what());
+    return 1;
+  }
+}
@@ -0,0 +1,357 @@
+#include "catalogue-snapshot.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace sanbot {
+namespace {
+
+constexpr char kMagic[8] = {'S', 'B', 'M', 'C', 'A', 'T', '\0', '\0'};
+constexpr uint32_t kVersion = 4;
+constexpr uint32_t kByteOrderMark = 0x01020304;
+constexpr std::size_t kSectionAlignment = 8;
+
+constexpr std::size_t catalogueTableCount() {
+  CatalogueTables tables;
+  std::size_t count = 0;
+  forEachCatalogueTable(tables, [&](const char *, auto &) { ++count; });
+  return count;
+}
+
+struct SnapshotSection {
+  uint64_t offset = 0;
+  uint64_t count = 0;
+  uint32_t elementSize = 0;
+  uint32_t reserved = 0;
+};
+
+struct SnapshotHeader {
+  char magic[8];
+  uint32_t version = kVersion;
+  uint32_t byteOrder = kByteOrderMark;
+  uint32_t headerSize = sizeof(SnapshotHeader);
+  uint32_t sectionCount = catalogueTableCount();
+  uint64_t fileSize = 0;
+  uint64_t sourceSize = 0;
+  uint64_t sourceHash = 0;
+  SnapshotSection sections[catalogueTableCount()];
+};
+
+std::size_t alignUp(std::size_t value) {
+  return (value + kSectionAlignment - 1) & ~(kSectionAlignment - 1);
+}
+
+class MappedFile {
+public:
+  explicit MappedFile(const std::string &path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+      return;
+    struct stat info {};
+    if (::fstat(fd, &info) == 0 && info.st_size > 0) {
+      void *data = ::mmap(nullptr, static_cast<std::size_t>(info.st_size),
+                          PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data != MAP_FAILED) {
+        data_ = data;
+        size_ = static_cast<std::size_t>(info.st_size);
+      }
+    }
+    ::close(fd);
+  }
+
+  ~MappedFile() {
+    if (data_)
+      ::munmap(data_, size_);
+  }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  void *release() {
+    void *data = data_;
+    data_ = nullptr;
+    return data;
+  }
+
+  const uint8_t *data() const { return static_cast<const uint8_t *>(data_); }
+  std::size_t size() const { return size_; }
+
+private:
+  void *data_ = nullptr;
+  std::size_t size_ = 0;
+};
+
+// Fast, non-cryptographic content hash; only used to notice that the
+// database a snapshot was compiled from has changed.
+uint64_t hashBytes(const uint8_t *data, std::size_t size) {
+  constexpr uint64_t kMultiplier = 0x9E3779B97F4A7C15ull;
+  uint64_t hash = 0xCBF29CE484222325ull ^ size;
+  std::size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t word;
+    std::memcpy(&word, data + i, sizeof(word));
+    hash = (hash ^ word) * kMultiplier;
+    hash ^= hash >> 29;
+  }
+  for (; i < size; ++i)
+    hash = (hash ^ data[i]) * kMultiplier;
+  return hash ^ (hash >> 32);
+}
+
+bool sourceFingerprint(const std::string &path, uint64_t &size,
+                       uint64_t &hash) {
+  MappedFile source(path);
+  if (!source.data())
+    return false;
+  size = source.size();
+  hash = hashBytes(source.data(), source.size());
+  return true;
+}
+
+bool textInBounds(const CatalogueTables &t, TextRef ref) {
+  return ref.offset <= t.text.size() && ref.length <= t.text.size() - ref.offset;
+}
+
+bool rangeInBounds(PlanRange range, std::size_t size) {
+  return range.begin <= size && range.count <= size - range.begin;
+}
+
+bool indexInBounds(int32_t index, std::size_t size, bool optional = true) {
+  if (index < 0)
+    return optional && index == -1;
+  return static_cast<std::size_t>(index) < size;
+}
+
+bool slotInBounds(int32_t slot) {
+  return indexInBounds(slot, kMaxPlanContextSlots);
+}
+
+// Every index and text reference in a mapped image is checked once at open so
+// that the build path can keep trusting them without per-access checks.
+bool catalogueIsConsistent(const CatalogueTables &t) {
+  if (t.commands.size() != t.plans.size())
+    return false;
+
+  for (const auto &command : t.commands) {
+    for (TextRef ref :
+         {command.canonicalName, command.commandGroup, command.commandModeHex,
+          command.ackDefaultHex, command.targetName, command.routeTagHex,
+          command.routeHandling, command.payloadTemplate, command.description})
+      if (!textInBounds(t, ref))
+        return false;
+    if (!rangeInBounds(command.aliases, t.aliasNames.size()) ||
+        !rangeInBounds(command.parameters, t.parameters.size()))
+      return false;
+  }
+
+  for (const auto &parameter : t.parameters) {
+    for (TextRef ref : {parameter.fieldName, parameter.fieldRole,
+                        parameter.valueExpr, parameter.valueHex,
+                        parameter.conditionExpr, parameter.description})
+      if (!textInBounds(t, ref))
+        return false;
+    if (!rangeInBounds(parameter.valueAliases, t.valueAliases.size()))
+      return false;
+  }
+
+  for (const auto &alias : t.valueAliases)
+    if (!textInBounds(t, alias.name))
+      return false;
+
+  for (TextRef ref : t.aliasNames)
+    if (!textInBounds(t, ref))
+      return false;
+  for (TextRef ref : t.argumentKeys)
+    if (!textInBounds(t, ref))
+      return false;
+  for (uint32_t slot : t.keySlots)
+    if (slot >= kMaxArgumentSlots)
+      return false;
+
+  for (std::size_t i = 0; i < t.aliases.size(); ++i) {
+    const auto &alias = t.aliases[i];
+    if (!textInBounds(t, alias.key) ||
+        !indexInBounds(alias.command, t.commands.size()) ||
+        !rangeInBounds(alias.candidates, t.aliasCandidates.size()))
+      return false;
+    if (i > 0 && !(t.textOf(t.aliases[i - 1].key) < t.textOf(alias.key)))
+      return false;
+  }
+  for (uint32_t candidate : t.aliasCandidates)
+    if (candidate >= t.commands.size())
+      return false;
+
+  auto powerOfTwo = [](std::size_t n) { return n != 0 && (n & (n - 1)) == 0; };
+  if (!t.aliases.empty() &&
+      (!powerOfTwo(t.aliasSeeds.size()) || !powerOfTwo(t.aliasSlots.size())))
+    return false;
+  for (uint32_t slot : t.aliasSlots)
+    if (slot != kEmptyAliasSlot && slot >= t.aliases.size())
+      return false;
+
+  for (const auto &plan : t.plans) {
+    if (!rangeInBounds(plan.fields, t.fields.size()) ||
+        plan.fields.count > kMaxPlanFields ||
+        plan.contextSlots > kMaxPlanContextSlots ||
+        !rangeInBounds(plan.argumentKeys, t.argumentKeys.size()) ||
+        plan.argumentKeys.count > kMaxArgumentSlots ||
+        !slotInBounds(plan.commandModeSlot) || !textInBounds(t, plan.message))
+      return false;
+  }
+
+  for (const auto &name : t.names) {
+    if (!slotInBounds(name.contextSlot) ||
+        !indexInBounds(name.aliasParameter, t.parameters.size()) ||
+        !rangeInBounds(name.keys, t.keySlots.size()) ||
+        !textInBounds(t, name.text))
+      return false;
+  }
+
+  for (const auto &condition : t.conditions) {
+    if (condition.op > ConditionOp::Invalid ||
+        !indexInBounds(condition.name, t.names.size(),
+                       condition.op == ConditionOp::Always ||
+                           condition.op == ConditionOp::Invalid) ||
+        !rangeInBounds(condition.values, t.bytes.size()) ||
+        !textInBounds(t, condition.message))
+      return false;
+  }
+
+  for (const auto &field : t.fields) {
+    if (field.op > FieldOp::Invalid ||
+        !indexInBounds(field.parameter, t.parameters.size()) ||
+        !indexInBounds(field.condition, t.conditions.size()) ||
+        !indexInBounds(field.select, t.conditions.size(),
+                       field.op != FieldOp::Select) ||
+        !slotInBounds(field.rememberSlots[0]) ||
+        !slotInBounds(field.rememberSlots[1]) ||
+        !rangeInBounds(field.keys, t.keySlots.size()) ||
+        !rangeInBounds(field.halfKeys, t.keySlots.size()) ||
+        !textInBounds(t, field.name) || !textInBounds(t, field.message))
+      return false;
+    for (const auto &term : field.terms) {
+      if (term.kind > TermKind::Invalid ||
+          !indexInBounds(term.name, t.names.size(),
+                         term.kind != TermKind::Name) ||
+          !textInBounds(t, term.text))
+        return false;
+    }
+  }
+
+  return true;
+}
+
+} // namespace
+
+CatalogueSnapshot::~CatalogueSnapshot() {
+  if (data_)
+    ::munmap(data_, size_);
+}
+
+std::unique_ptr<CatalogueSnapshot>
+CatalogueSnapshot::open(const std::string &path,
+                        const std::string &sourcePath) {
+  MappedFile file(path);
+  if (!file.data() || file.size() < sizeof(SnapshotHeader))
+    return nullptr;
+
+  SnapshotHeader header;
+  std::memcpy(&header, file.data(), sizeof(header));
+  if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+      header.version != kVersion || header.byteOrder != kByteOrderMark ||
+      header.headerSize != sizeof(SnapshotHeader) ||
+      header.sectionCount != catalogueTableCount() ||
+      header.fileSize != file.size())
+    return nullptr;
+
+  uint64_t sourceSize = 0;
+  uint64_t sourceHash = 0;
+  if (!sourceFingerprint(sourcePath, sourceSize, sourceHash) ||
+      sourceSize != header.sourceSize || sourceHash != header.sourceHash)
+    return nullptr;
+
+  CatalogueTables tables;
+  std::size_t index = 0;
+  bool valid = true;
+  forEachCatalogueTable(tables, [&](const char *, auto &span) {
+    using Element = typename std::remove_reference_t<decltype(span)>::element_type;
+    const SnapshotSection &section = header.sections[index++];
+    if (section.elementSize != sizeof(Element) ||
+        section.offset % alignof(Element) != 0 ||
+        section.offset > file.size() ||
+        section.count > (file.size() - section.offset) / sizeof(Element)) {
+      valid = false;
+      return;
+    }
+    span = {reinterpret_cast<Element *>(file.data() + section.offset),
+            static_cast<std::size_t>(section.count)};
+  });
+  if (!valid || !catalogueIsConsistent(tables))
+    return nullptr;
+
+  std::unique_ptr<CatalogueSnapshot> snapshot(
+      new CatalogueSnapshot(nullptr, file.size()));
+  snapshot->data_ = file.release();
+  snapshot->tables_ = tables;
+  return snapshot;
+}
+
+void CatalogueSnapshot::write(const std::string &path,
+                              const std::string &sourcePath,
+                              const CatalogueTables &tables) {
+  SnapshotHeader header;
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  if (!sourceFingerprint(sourcePath, header.sourceSize, header.sourceHash))
+    throw std::runtime_error("failed to read command database '" +
+                             sourcePath + "' for snapshot");
+
+  std::size_t offset = alignUp(sizeof(SnapshotHeader));
+  std::size_t index = 0;
+  forEachCatalogueTable(tables, [&](const char *, const auto &span) {
+    SnapshotSection &section = header.sections[index++];
+    section.offset = offset;
+    section.count = span.size();
+    section.elementSize = sizeof(span[0]);
+    offset = alignUp(offset + span.size_bytes());
+  });
+  header.fileSize = offset;
+
+  std::string tempPath = path + ".tmp";
+  {
+    std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+    if (!out)
+      throw std::runtime_error("failed to create snapshot '" + tempPath + "'");
+
+    static const char padding[kSectionAlignment] = {};
+    auto pad = [&]() {
+      std::size_t written = static_cast<std::size_t>(out.tellp());
+      out.write(padding, static_cast<std::streamsize>(alignUp(written) -
+                                                      written));
+    };
+
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    pad();
+    forEachCatalogueTable(tables, [&](const char *, const auto &span) {
+      out.write(reinterpret_cast<const char *>(span.data()),
+                static_cast<std::streamsize>(span.size_bytes()));
+      pad();
+    });
+    if (!out.flush())
+      throw std::runtime_error("failed to write snapshot '" + tempPath + "'");
+  }
+
+  std::error_code error;
+  std::filesystem::rename(tempPath, path, error);
+  if (error)
+    throw std::runtime_error("failed to install snapshot '" + path +
+                             "': " + error.message());
+}
+
+} // namespace sanbot
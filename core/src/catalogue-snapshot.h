@@ -0,0 +1,39 @@
+#pragma once
+
+#include "catalogue-tables.h"
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+namespace sanbot {
+
+// A compiled catalogue written to disk as one position-independent image that
+// is mapped read-only and used in place. The header records the size and
+// content hash of the SQLite file it was compiled from; open() refuses the
+// image when the database has changed, when it was written by a different
+// layout version or byte order, or when any table fails bounds validation.
+class CatalogueSnapshot {
+public:
+  ~CatalogueSnapshot();
+
+  CatalogueSnapshot(const CatalogueSnapshot &) = delete;
+  CatalogueSnapshot &operator=(const CatalogueSnapshot &) = delete;
+
+  // Returns nullptr when the snapshot is missing, stale or unusable.
+  static std::unique_ptr<CatalogueSnapshot> open(const std::string &path,
+                                                 const std::string &sourcePath);
+  static void write(const std::string &path, const std::string &sourcePath,
+                    const CatalogueTables &tables);
+
+  const CatalogueTables &tables() const { return tables_; }
+
+private:
+  CatalogueSnapshot(void *data, std::size_t size) : data_(data), size_(size) {}
+
+  void *data_ = nullptr;
+  std::size_t size_ = 0;
+  CatalogueTables tables_;
+};
+
+} // namespace sanbot
@@ -0,0 +1,186 @@
+#include "catalogue-sqlite.h"
+
+#include <stdexcept>
+
+#ifndef SANBOT_NO_SQLITE
+#include <sqlite3.h>
+#endif
+
+namespace sanbot {
+
+#ifndef SANBOT_NO_SQLITE
+
+namespace {
+
+std::string sqliteText(sqlite3_stmt *stmt, int column) {
+  const unsigned char *text = sqlite3_column_text(stmt, column);
+  return text ? reinterpret_cast<const char *>(text) : "";
+}
+
+struct SQLiteHandle {
+  sqlite3 *db = nullptr;
+
+  explicit SQLiteHandle(const std::string &path) {
+    if (sqlite3_open_v2(path.c_str(), &db, SQLITE_OPEN_READONLY, nullptr) !=
+        SQLITE_OK) {
+      std::string message = db ? sqlite3_errmsg(db) : "sqlite open failed";
+      if (db)
+        sqlite3_close(db);
+      db = nullptr;
+      throw std::runtime_error("failed to open command database '" + path +
+                               "': " + message);
+    }
+  }
+
+  ~SQLiteHandle() {
+    if (db)
+      sqlite3_close(db);
+  }
+
+  SQLiteHandle(const SQLiteHandle &) = delete;
+  SQLiteHandle &operator=(const SQLiteHandle &) = delete;
+};
+
+struct Statement {
+  sqlite3_stmt *stmt = nullptr;
+
+  Statement(sqlite3 *db, const std::string &sql) {
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
+      throw std::runtime_error("sqlite prepare failed: " +
+                               std::string(sqlite3_errmsg(db)));
+  }
+
+  ~Statement() {
+    if (stmt)
+      sqlite3_finalize(stmt);
+  }
+
+  Statement(const Statement &) = delete;
+  Statement &operator=(const Statement &) = delete;
+
+  bool step() {
+    int rc = sqlite3_step(stmt);
+    if (rc == SQLITE_ROW)
+      return true;
+    if (rc == SQLITE_DONE)
+      return false;
+    throw std::runtime_error("sqlite step failed");
+  }
+};
+
+} // namespace
+
+std::vector<CommandInfo> loadSqliteCommands(const std::string &dbPath) {
+  SQLiteHandle db(dbPath);
+  std::vector<CommandInfo> commands;
+
+  Statement rows(
+      db.db,
+      "SELECT c.command_id, c.canonical_name, c.command_group, "
+      "c.command_mode_hex, c.ack_default_hex, c.payload_template, "
+      "c.description, t.name, COALESCE(t.route_tag_hex, ''), "
+      "c.route_handling, "
+      "f.payload_field_id, f.ordinal, f.payload_offset, f.field_name, "
+      "f.field_role, COALESCE(f.value_expr, ''), COALESCE(f.value_hex, ''), "
+      "COALESCE(f.condition_expr, ''), f.omit_if_minus_one, "
+      "COALESCE(f.description, '') "
+      "FROM commands c "
+      "JOIN usb_targets t ON t.target_id = c.target_id "
+      "LEFT JOIN command_payload_fields f ON f.command_id = c.command_id "
+      "ORDER BY c.canonical_name, f.payload_offset, f.ordinal");
+
+  while (rows.step()) {
+    int commandId = sqlite3_column_int(rows.stmt, 0);
+    if (commands.empty() || commands.back().commandId != commandId) {
+      CommandInfo info;
+      info.commandId = commandId;
+      info.canonicalName = sqliteText(rows.stmt, 1);
+      info.commandGroup = sqliteText(rows.stmt, 2);
+      info.commandModeHex = sqliteText(rows.stmt, 3);
+      info.ackDefaultHex = sqliteText(rows.stmt, 4);
+      info.payloadTemplate = sqliteText(rows.stmt, 5);
+      info.description = sqliteText(rows.stmt, 6);
+      info.targetName = sqliteText(rows.stmt, 7);
+      info.routeTagHex = sqliteText(rows.stmt, 8);
+      info.routeHandling = sqliteText(rows.stmt, 9);
+      commands.push_back(std::move(info));
+    }
+
+    if (sqlite3_column_type(rows.stmt, 10) == SQLITE_NULL)
+      continue;
+
+    CommandParameter parameter;
+    parameter.ordinal = sqlite3_column_int(rows.stmt, 11);
+    parameter.payloadOffset = sqlite3_column_int(rows.stmt, 12);
+    parameter.fieldName = sqliteText(rows.stmt, 13);
+    parameter.fieldRole = sqliteText(rows.stmt, 14);
+    parameter.valueExpr = sqliteText(rows.stmt, 15);
+    parameter.valueHex = sqliteText(rows.stmt, 16);
+    parameter.conditionExpr = sqliteText(rows.stmt, 17);
+    parameter.omitIfMinusOne = sqlite3_column_int(rows.stmt, 18) != 0;
+    parameter.description = sqliteText(rows.stmt, 19);
+    commands.back().parameters.push_back(std::move(parameter));
+  }
+
+  return commands;
+}
+
+std::vector<ReceiveCaseInfo> loadSqliteReceiveCases(const std::string &dbPath) {
+  SQLiteHandle db(dbPath);
+  std::vector<ReceiveCaseInfo> cases;
+
+  Statement rows(
+      db.db,
+      "SELECT r.receive_case_id, COALESCE(p.primary_byte_hex, ''), p.label, "
+      "r.decoded_class_name, COALESCE(r.command_type_int, 0), "
+      "COALESCE(r.payload_match_expr, ''), "
+      "f.receive_field_id, COALESCE(f.payload_offset, -1), f.field_name, "
+      "COALESCE(f.field_type, ''), f.decode_expr "
+      "FROM mcu_receive_cases r "
+      "JOIN receive_primary_switch p ON p.primary_id = r.primary_id "
+      "LEFT JOIN receive_payload_fields f "
+      "ON f.receive_case_id = r.receive_case_id "
+      "ORDER BY r.receive_case_id, f.receive_field_id");
+
+  while (rows.step()) {
+    int caseId = sqlite3_column_int(rows.stmt, 0);
+    if (cases.empty() || cases.back().receiveCaseId != caseId) {
+      ReceiveCaseInfo info;
+      info.receiveCaseId = caseId;
+      info.primaryByteHex = sqliteText(rows.stmt, 1);
+      info.primaryLabel = sqliteText(rows.stmt, 2);
+      info.className = sqliteText(rows.stmt, 3);
+      info.commandType = sqlite3_column_int(rows.stmt, 4);
+      info.matchExpr = sqliteText(rows.stmt, 5);
+      cases.push_back(std::move(info));
+    }
+
+    if (sqlite3_column_type(rows.stmt, 6) == SQLITE_NULL)
+      continue;
+
+    ReceiveFieldInfo field;
+    field.payloadOffset = sqlite3_column_int(rows.stmt, 7);
+    field.fieldName = sqliteText(rows.stmt, 8);
+    field.fieldType = sqliteText(rows.stmt, 9);
+    field.decodeExpr = sqliteText(rows.stmt, 10);
+    cases.back().fields.push_back(std::move(field));
+  }
+
+  return cases;
+}
+
+#else
+
+std::vector<CommandInfo> loadSqliteCommands(const std::string &dbPath) {
+  throw std::runtime_error("cannot open command database '" + dbPath +
+                           "': built without SQLite support");
+}
+
+std::vector<ReceiveCaseInfo> loadSqliteReceiveCases(const std::string &dbPath) {
+  throw std::runtime_error("cannot open command database '" + dbPath +
+                           "': built without SQLite support");
+}
+
+#endif
+
+} // namespace sanbot
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "command-database.h"
+#include "receive-decoder.h"
+
+#include <string>
+#include <vector>
+
+namespace sanbot {
+
+// Reads the outgoing command tables from a catalogue SQLite file. Throws when
+// the library was built with SANBOT_NO_SQLITE.
+std::vector<CommandInfo> loadSqliteCommands(const std::string &dbPath);
+
+// Reads the incoming receive cases, ordered by receive_case_id.
+std::vector<ReceiveCaseInfo> loadSqliteReceiveCases(const std::string &dbPath);
+
+} // namespace sanbot
@@ -0,0 +1,245 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <string_view>
+#include <vector>
+
+namespace sanbot {
+
+// The compiled command catalogue. Everything CommandDatabase needs at runtime
+// lives in flat arrays of plain records that refer to each other by index and
+// to the text pool by offset, so the same tables can be built from SQLite or
+// used straight out of a mapped snapshot file.
+//
+// Build plans are compiled from CommandInfo when the catalogue is loaded so
+// that buildCommand never re-parses condition or value expressions.
+
+struct TextRef {
+  uint32_t offset = 0;
+  uint32_t length = 0;
+};
+
+struct PlanRange {
+  uint32_t begin = 0;
+  uint32_t count = 0;
+};
+
+struct CommandRecord {
+  int32_t commandId = 0;
+  TextRef canonicalName;
+  TextRef commandGroup;
+  TextRef commandModeHex;
+  TextRef ackDefaultHex;
+  TextRef targetName;
+  TextRef routeTagHex;
+  TextRef routeHandling;
+  TextRef payloadTemplate;
+  TextRef description;
+  PlanRange aliases;
+  PlanRange parameters;
+};
+
+struct ParameterRecord {
+  int32_t ordinal = 0;
+  int32_t payloadOffset = 0;
+  TextRef fieldName;
+  TextRef fieldRole;
+  TextRef valueExpr;
+  TextRef valueHex;
+  TextRef conditionExpr;
+  TextRef description;
+  uint32_t omitIfMinusOne = 0;
+  PlanRange valueAliases;
+};
+
+// A named value accepted for a parameter (direction=forward), keyed by the
+// normalized name. Each parameter's range is sorted by name.
+struct ValueAliasRecord {
+  TextRef name;
+  uint8_t value = 0;
+};
+
+// Normalized alias to command index, sorted by key. Aliases shared by several
+// commands keep command = -1 and list every owner in candidates.
+//
+// aliasSeeds/aliasSlots form a perfect hash over the normalized keys: the high
+// half of the key hash picks a seed, the seeded hash picks a slot, and the slot
+// holds the alias index (kEmptyAliasSlot when unused). Both table sizes are
+// powers of two.
+inline constexpr uint32_t kEmptyAliasSlot = 0xFFFFFFFFu;
+
+struct AliasRecord {
+  TextRef key;
+  int32_t command = -1;
+  PlanRange candidates;
+};
+
+enum class FieldOp : uint8_t {
+  Skip,
+  Constant,
+  Argument,
+  HalfWord,
+  Array,
+  Select,
+  Invalid,
+};
+
+enum class ConditionOp : uint8_t {
+  Always,
+  Equal,
+  NotEqual,
+  In,
+  Invalid,
+};
+
+enum class TermKind : uint8_t {
+  Literal,
+  Name,
+  Invalid,
+};
+
+// A name read by a condition or a select term. Values already produced by the
+// build win over caller arguments, matching the Java builders.
+struct PlanName {
+  int32_t contextSlot = -1;
+  int32_t aliasParameter = -1;
+  PlanRange keys;
+  TextRef text;
+};
+
+struct PlanCondition {
+  ConditionOp op = ConditionOp::Always;
+  int32_t name = -1;
+  PlanRange values;
+  TextRef message;
+};
+
+struct PlanTerm {
+  TermKind kind = TermKind::Literal;
+  uint8_t value = 0;
+  int32_t name = -1;
+  TextRef text;
+};
+
+struct FieldPlan {
+  FieldOp op = FieldOp::Skip;
+  uint8_t constant = 0;
+  bool lowByte = false;
+  int32_t parameter = -1;
+  int32_t condition = -1;
+  int32_t select = -1;
+  int32_t rememberSlots[2] = {-1, -1};
+  PlanTerm terms[2];
+  PlanRange keys;
+  PlanRange halfKeys;
+  TextRef name;
+  TextRef message;
+};
+
+// Argument keys are bound to per-command slots once, when the caller's
+// arguments are looked up; keys/halfKeys ranges then index keySlots, whose
+// entries are slot numbers. argumentKeys lists each command's distinct keys in
+// slot order, sorted by normalized key.
+struct CommandPlan {
+  uint8_t commandMode = 0;
+  uint8_t ackFlag = 0x01;
+  bool hasRouteTag = false;
+  uint8_t routeTag = 0;
+  int32_t commandModeSlot = -1;
+  uint32_t contextSlots = 0;
+  PlanRange fields;
+  PlanRange argumentKeys;
+  TextRef message;
+};
+
+inline constexpr std::size_t kMaxPlanFields = 64;
+inline constexpr std::size_t kMaxPlanContextSlots = 64;
+inline constexpr std::size_t kMaxArgumentSlots = 64;
+
+struct CatalogueTables {
+  std::span<const CommandRecord> commands;
+  std::span<const ParameterRecord> parameters;
+  std::span<const ValueAliasRecord> valueAliases;
+  std::span<const TextRef> aliasNames;
+  std::span<const AliasRecord> aliases;
+  std::span<const uint32_t> aliasCandidates;
+  std::span<const uint32_t> aliasSeeds;
+  std::span<const uint32_t> aliasSlots;
+  std::span<const CommandPlan> plans;
+  std::span<const FieldPlan> fields;
+  std::span<const PlanCondition> conditions;
+  std::span<const PlanName> names;
+  std::span<const uint32_t> keySlots;
+  std::span<const TextRef> argumentKeys;
+  std::span<const uint8_t> bytes;
+  std::span<const char> text;
+
+  std::string_view textOf(TextRef ref) const {
+    return std::string_view(text.data() + ref.offset, ref.length);
+  }
+};
+
+struct CatalogueStorage {
+  std::vector<CommandRecord> commands;
+  std::vector<ParameterRecord> parameters;
+  std::vector<ValueAliasRecord> valueAliases;
+  std::vector<TextRef> aliasNames;
+  std::vector<AliasRecord> aliases;
+  std::vector<uint32_t> aliasCandidates;
+  std::vector<uint32_t> aliasSeeds;
+  std::vector<uint32_t> aliasSlots;
+  std::vector<CommandPlan> plans;
+  std::vector<FieldPlan> fields;
+  std::vector<PlanCondition> conditions;
+  std::vector<PlanName> names;
+  std::vector<uint32_t> keySlots;
+  std::vector<TextRef> argumentKeys;
+  std::vector<uint8_t> bytes;
+  std::vector<char> text;
+};
+
+// Visits every table in a fixed order. Works for both CatalogueTables and
+// CatalogueStorage; the snapshot file lays its sections out in this order.
+template <typename Tables, typename Fn>
+constexpr void forEachCatalogueTable(Tables &tables, Fn &&fn) {
+  fn("commands", tables.commands);
+  fn("parameters", tables.parameters);
+  fn("valueAliases", tables.valueAliases);
+  fn("aliasNames", tables.aliasNames);
+  fn("aliases", tables.aliases);
+  fn("aliasCandidates", tables.aliasCandidates);
+  fn("aliasSeeds", tables.aliasSeeds);
+  fn("aliasSlots", tables.aliasSlots);
+  fn("plans", tables.plans);
+  fn("fields", tables.fields);
+  fn("conditions", tables.conditions);
+  fn("names", tables.names);
+  fn("keySlots", tables.keySlots);
+  fn("argumentKeys", tables.argumentKeys);
+  fn("bytes", tables.bytes);
+  fn("text", tables.text);
+}
+
+inline CatalogueTables viewOf(const CatalogueStorage &storage) {
+  CatalogueTables tables;
+  tables.commands = storage.commands;
+  tables.parameters = storage.parameters;
+  tables.valueAliases = storage.valueAliases;
+  tables.aliasNames = storage.aliasNames;
+  tables.aliases = storage.aliases;
+  tables.aliasCandidates = storage.aliasCandidates;
+  tables.aliasSeeds = storage.aliasSeeds;
+  tables.aliasSlots = storage.aliasSlots;
+  tables.plans = storage.plans;
+  tables.fields = storage.fields;
+  tables.conditions = storage.conditions;
+  tables.names = storage.names;
+  tables.keySlots = storage.keySlots;
+  tables.argumentKeys = storage.argumentKeys;
+  tables.bytes = storage.bytes;
+  tables.text = storage.text;
+  return tables;
+}
+
+} // namespace sanbot
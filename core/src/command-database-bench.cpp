@@ -0,0 +1,611 @@
+#include "byte-sum.h"
+#include "command-database.h"
+#include "frame-parser.h"
+#include "frame-ring.h"
+#include "packet-assembler.h"
+#include "receive-decoder.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <queue>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+using sanbot::ArgumentSlots;
+using sanbot::CommandArgs;
+using sanbot::CommandDatabase;
+using sanbot::CommandInfo;
+using sanbot::SnapshotPolicy;
+
+namespace {
+
+std::atomic<std::size_t> allocationCount{0};
+
+// Kept out of line so that GCC, once it inlines operator delete, does not see
+// free() applied to the result of operator new and warn about a mismatch.
+[[gnu::noinline]] void *countedAlloc(std::size_t size) {
+  allocationCount.fetch_add(1, std::memory_order_relaxed);
+  return std::malloc(size ? size : 1);
+}
+
+[[gnu::noinline]] void countedFree(void *p) noexcept { std::free(p); }
+
+} // namespace
+
+void *operator new(std::size_t size) {
+  if (void *p = countedAlloc(size))
+    return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { countedFree(p); }
+void operator delete(void *p, std::size_t) noexcept { countedFree(p); }
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct BenchCase {
+  std::string name;
+  CommandArgs args;
+};
+
+double nanosecondsSince(Clock::time_point start, std::size_t operations) {
+  auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      Clock::now() - start);
+  return static_cast<double>(elapsed.count()) /
+         static_cast<double>(operations ? operations : 1);
+}
+
+// Supplies every variable field of a command with a small value so that each
+// catalogue entry builds through its default (unconditional or mode 0x01)
+// branch.
+CommandArgs defaultArgsFor(const CommandInfo &command) {
+  CommandArgs args;
+  for (const auto &field : command.parameters) {
+    if (!field.valueHex.empty() || field.valueExpr.empty() ||
+        field.valueExpr == "constant")
+      continue;
+    if (field.valueExpr.size() > 2 &&
+        field.valueExpr.compare(field.valueExpr.size() - 2, 2, "[]") == 0) {
+      args.insert_or_assign(field.fieldName, std::string("1,2,3,4"));
+    } else if (field.valueExpr.find('?') != std::string::npos) {
+      args.insert_or_assign(
+          field.valueExpr.substr(0, field.valueExpr.find(' ')),
+          std::string("1"));
+    } else {
+      args.insert_or_assign(field.fieldName, std::string("1"));
+    }
+  }
+  return args;
+}
+
+std::vector<BenchCase> catalogueCases(const CommandDatabase &db) {
+  std::vector<BenchCase> cases;
+  for (const auto &command : db.commands())
+    cases.push_back({command.canonicalName, defaultArgsFor(command)});
+
+  cases.push_back({"wheel", CommandArgs{{"mode", "distance"},
+                                        {"direction", "forward"},
+                                        {"speed", "50"},
+                                        {"distance", "1000"}}});
+  cases.push_back({"wheel", CommandArgs{{"mode", "timed"},
+                                        {"direction", "right"},
+                                        {"time", "500"},
+                                        {"degree", "45"}}});
+  cases.push_back({"head", CommandArgs{{"mode", "locate-absolute"},
+                                       {"lock", "both-lock"},
+                                       {"horizontal-degree", "30"},
+                                       {"vertical-degree", "20"}}});
+  cases.push_back({"arm", CommandArgs{{"mode", "no-angle"},
+                                      {"hand", "left"},
+                                      {"speed", "40"},
+                                      {"action", "up"}}});
+  return cases;
+}
+
+void benchBuildCommand(const CommandDatabase &db, std::size_t iterations) {
+  std::vector<BenchCase> cases = catalogueCases(db);
+  std::vector<BenchCase> buildable;
+  for (auto &benchCase : cases) {
+    try {
+      db.buildCommand(benchCase.name, benchCase.args);
+      buildable.push_back(std::move(benchCase));
+    } catch (const std::exception &ex) {
+      std::fprintf(stderr, "skipping %s: %s\n", benchCase.name.c_str(),
+                   ex.what());
+    }
+  }
+
+  std::size_t checksum = 0;
+  auto start = Clock::now();
+  for (std::size_t i = 0; i < iterations; ++i) {
+    for (const auto &benchCase : buildable)
+      checksum += db.buildCommand(benchCase.name, benchCase.args).bytes.size();
+  }
+  double perBuild = nanosecondsSince(start, iterations * buildable.size());
+
+  std::printf("buildCommand: %zu cases x %zu iterations, %.0f ns/build "
+              "(checksum %zu)\n",
+              buildable.size(), iterations, perBuild, checksum);
+
+  std::vector<std::vector<std::optional<std::string_view>>> slots;
+  for (const auto &benchCase : buildable) {
+    auto &bound = slots.emplace_back(db.argumentSlotCount(benchCase.name));
+    for (const auto &[key, value] : benchCase.args)
+      if (auto slot = db.argumentSlot(benchCase.name, key))
+        bound[*slot] = value;
+  }
+
+  checksum = 0;
+  start = Clock::now();
+  for (std::size_t i = 0; i < iterations; ++i) {
+    for (std::size_t c = 0; c < buildable.size(); ++c)
+      checksum += db.buildCommand(buildable[c].name, ArgumentSlots(slots[c]))
+                      .bytes.size();
+  }
+  perBuild = nanosecondsSince(start, iterations * buildable.size());
+
+  std::printf("buildCommand (argument slots): %.0f ns/build (checksum %zu)\n",
+              perBuild, checksum);
+
+  auto wheel = db.prepare("wheel", {"mode", "direction", "speed", "distance"});
+  checksum = 0;
+  start = Clock::now();
+  for (std::size_t i = 0; i < iterations * buildable.size(); ++i)
+    checksum += wheel.build(0x11, 0x01, 50, int(i % 1000)).bytes.size();
+  perBuild = nanosecondsSince(start, iterations * buildable.size());
+
+  std::printf("PreparedCommand::build (wheel): %.0f ns/build (checksum %zu)\n",
+              perBuild, checksum);
+
+  std::vector<sanbot::CommandRequest> requests;
+  for (const auto &benchCase : buildable)
+    requests.push_back({benchCase.name, benchCase.args});
+  sanbot::CommandBatch batch;
+  checksum = 0;
+  start = Clock::now();
+  for (std::size_t i = 0; i < iterations; ++i) {
+    db.buildBatch(requests, batch);
+    checksum += batch.bytes.size();
+  }
+  perBuild = nanosecondsSince(start, iterations * buildable.size());
+
+  std::printf("buildBatch: %.0f ns/frame (checksum %zu)\n", perBuild,
+              checksum);
+
+  sanbot::FrameTemplate wheelFrame(wheel);
+  std::size_t patched = 0;
+  checksum = 0;
+  start = Clock::now();
+  for (std::size_t i = 0; i < iterations * buildable.size(); ++i) {
+    checksum += wheelFrame.update(0x11, 0x01, 50, int(i % 1000)).bytes.size();
+    patched += wheelFrame.lastUpdatePatched();
+  }
+  perBuild = nanosecondsSince(start, iterations * buildable.size());
+
+  std::printf("FrameTemplate::update (wheel): %.0f ns/update, %zu of %zu "
+              "patched (checksum %zu)\n",
+              perBuild, patched, iterations * buildable.size(), checksum);
+}
+
+// Rejected candidate argument sets, as a validator probing speeds would see
+// them: buildCommand throws, tryBuildCommand and tryBuild return the error.
+void benchRejectedBuilds(const CommandDatabase &db, std::size_t iterations) {
+  CommandArgs tooFast{{"mode", "distance"},
+                      {"direction", "forward"},
+                      {"speed", "300"},
+                      {"distance", "1000"}};
+  std::size_t rejected = 0;
+  auto start = Clock::now();
+  for (std::size_t i = 0; i < iterations; ++i) {
+    try {
+      db.buildCommand("wheel", tooFast);
+    } catch (const std::exception &) {
+      ++rejected;
+    }
+  }
+  double perThrow = nanosecondsSince(start, iterations);
+
+  std::size_t before = allocationCount.load();
+  start = Clock::now();
+  for (std::size_t i = 0; i < iterations; ++i)
+    rejected += !db.tryBuildCommand("wheel", tooFast).has_value();
+  double perTry = nanosecondsSince(start, iterations);
+  std::size_t tryAllocations = allocationCount.load() - before;
+
+  auto wheel = db.prepare("wheel", {"mode", "direction", "speed", "distance"});
+  before = allocationCount.load();
+  start = Clock::now();
+  for (std::size_t i = 0; i < iterations; ++i)
+    rejected += !wheel.tryBuild(0x11, 0x01, 256 + int(i % 100), 1000);
+  double perPrepared = nanosecondsSince(start, iterations);
+  std::size_t preparedAllocations = allocationCount.load() - before;
+
+  std::printf("rejected build: buildCommand %.0f ns, tryBuildCommand %.0f ns "
+              "(%zu allocations), PreparedCommand::tryBuild %.0f ns "
+              "(%zu allocations) (rejected %zu)\n",
+              perThrow, perTry, tryAllocations, perPrepared,
+              preparedAllocations, rejected);
+}
+
+// A 4 KiB array argument framed from comma-separated text and from a
+// borrowed view, each gathered into the contiguous frame libusb is given.
+void benchScatter(const CommandDatabase &db, std::size_t iterations) {
+  std::vector<uint8_t> data(4096);
+  std::string text;
+  for (std::size_t i = 0; i < data.size(); ++i) {
+    data[i] = static_cast<uint8_t>(i % 0xFF);
+    text += std::to_string(data[i]) + ",";
+  }
+  CommandArgs args{{"data", text}};
+  iterations = iterations / 10 + 1;
+
+  std::size_t checksum = 0;
+  auto start = Clock::now();
+  for (std::size_t i = 0; i < iterations; ++i)
+    checksum += db.buildCommand("ZigbeeCommand", args).bytes.size();
+  double perBuild = nanosecondsSince(start, iterations);
+  std::printf("buildCommand (4 KiB array as text): %.0f ns/build "
+              "(checksum %zu)\n",
+              perBuild, checksum);
+
+  checksum = 0;
+  start = Clock::now();
+  for (std::size_t i = 0; i < iterations; ++i)
+    checksum += db.buildScatterCommand("ZigbeeCommand", CommandArgs{}, data)
+                    .frame.gather()
+                    .size();
+  perBuild = nanosecondsSince(start, iterations);
+  std::printf("buildScatterCommand (4 KiB borrowed) + gather: %.0f ns/build "
+              "(checksum %zu)\n",
+              perBuild, checksum);
+}
+
+// Byte sums through every available kernel, and validation of whole frames
+// through the selected one, for payloads from 1 byte to 64 KiB.
+void benchChecksum(std::size_t iterations) {
+  std::vector<uint8_t> data(64 * 1024);
+  for (std::size_t i = 0; i < data.size(); ++i)
+    data[i] = static_cast<uint8_t>(i * 7 % 0xFF);
+
+  std::printf("byte sum kernel: %s\n", byteSumKernel().name);
+  for (std::size_t size = 1; size <= data.size(); size *= 4) {
+    std::size_t rounds = std::max<std::size_t>(iterations * 64 / size, 16);
+    std::printf("  %6zu B:", size);
+    for (const ByteSumKernel &kernel : availableByteSumKernels()) {
+      uint32_t checksum = 0;
+      auto start = Clock::now();
+      for (std::size_t i = 0; i < rounds; ++i)
+        checksum += kernel.sum(data.data(), size);
+      double perSum = nanosecondsSince(start, rounds);
+      std::printf(" %s %.0f ns (%.2f GB/s, %08X)", kernel.name, perSum,
+                  static_cast<double>(size) / perSum, checksum);
+    }
+
+    // mmnn is 16 bits, so the largest frame carries 64 KiB - 2 bytes.
+    std::size_t payload = std::min<std::size_t>(size, 0xFFFE);
+    std::vector<uint8_t> frame =
+        buildUsbFrame(UsbFrameParams{0x01},
+                      std::span<const uint8_t>(data).first(payload));
+    std::size_t valid = 0;
+    auto start = Clock::now();
+    for (std::size_t i = 0; i < rounds; ++i)
+      valid += validateUsbFrame(frame) == FrameStatus::Ok;
+    std::printf(" | validate %.0f ns (%zu ok)\n",
+                nanosecondsSince(start, rounds), valid);
+  }
+}
+
+// A stream of sensor-sized frames delivered in 512-byte bulk reads, so most
+// reads end part way through a frame.
+void benchFrameParser(std::size_t iterations) {
+  std::vector<uint8_t> stream;
+  std::size_t frames = 0;
+  for (std::size_t i = 0; stream.size() < 64 * 1024; ++i) {
+    std::vector<uint8_t> datas(4 + i % 40, static_cast<uint8_t>(i));
+    std::vector<uint8_t> frame = buildUsbFrame(UsbFrameParams{0x01}, datas);
+    stream.insert(stream.end(), frame.begin(), frame.end());
+    ++frames;
+  }
+
+  UsbFrameParser parser;
+  std::size_t payloadBytes = 0;
+  std::size_t before = allocationCount.load();
+  auto start = Clock::now();
+  for (std::size_t i = 0; i < iterations / 10 + 1; ++i) {
+    for (std::size_t at = 0; at < stream.size(); at += 512) {
+      std::span<const uint8_t> chunk(stream.data() + at,
+                                     std::min<std::size_t>(512,
+                                                           stream.size() - at));
+      parser.feed(chunk, [&](const ReceivedFrame &frame) {
+        payloadBytes += frame.payload.size();
+      });
+    }
+  }
+  double elapsed = nanosecondsSince(start, 1);
+  std::size_t allocations = allocationCount.load() - before;
+  std::printf("UsbFrameParser: %.0f ns/frame, %.2f GB/s, %llu frames of %zu "
+              "expected, %zu allocations (payload %zu)\n",
+              elapsed / static_cast<double>(parser.stats().frames),
+              static_cast<double>(stream.size() * (iterations / 10 + 1)) /
+                  elapsed,
+              static_cast<unsigned long long>(parser.stats().frames),
+              frames * (iterations / 10 + 1), allocations, payloadBytes);
+}
+
+// 1 to 8 threads pushing command-sized frames at one consumer, through the
+// send lanes' FrameRing and through a mutex-guarded std::queue as the lanes
+// used before. Both consumers poll, so only the queues themselves differ.
+// Allocations exclude the producer threads' own.
+void benchSendQueue(std::size_t iterations) {
+  Frame frame(26);
+  for (std::size_t i = 0; i < frame.size(); ++i)
+    frame[i] = static_cast<uint8_t>(i);
+  std::size_t total = iterations * 100;
+
+  for (unsigned producers = 1; producers <= 8; ++producers) {
+    std::size_t perProducer = total / producers;
+    std::size_t expected = perProducer * producers;
+
+    auto run = [&](auto push, auto pop) {
+      std::vector<std::thread> threads;
+      threads.reserve(producers);
+      std::size_t allocations = allocationCount.load();
+      auto start = Clock::now();
+      for (unsigned p = 0; p < producers; ++p) {
+        threads.emplace_back([&] {
+          for (std::size_t i = 0; i < perProducer; ++i)
+            push(frame);
+        });
+      }
+      Frame out;
+      for (std::size_t received = 0; received < expected;) {
+        if (pop(out))
+          ++received;
+        else
+          std::this_thread::yield();
+      }
+      double perFrame = nanosecondsSince(start, expected);
+      for (std::thread &thread : threads)
+        thread.join();
+      return std::pair{perFrame,
+                       allocationCount.load() - allocations - producers};
+    };
+
+    auto ring = std::make_unique<FrameRing<256>>();
+    auto [ringNs, ringAllocations] = run(
+        [&](Frame copy) {
+          while (!ring->tryPush(copy))
+            std::this_thread::yield();
+        },
+        [&](Frame &out) { return ring->tryPop(out); });
+
+    std::mutex mtx;
+    std::queue<Frame> queue;
+    auto [lockedNs, lockedAllocations] = run(
+        [&](Frame copy) {
+          std::lock_guard<std::mutex> lock(mtx);
+          queue.push(std::move(copy));
+        },
+        [&](Frame &out) {
+          std::lock_guard<std::mutex> lock(mtx);
+          if (queue.empty())
+            return false;
+          out = std::move(queue.front());
+          queue.pop();
+          return true;
+        });
+
+    std::printf("send queue, %u producer%s: ring %.0f ns/frame (%zu allocs), "
+                "mutex queue %.0f ns/frame (%zu allocs), %zu frames\n",
+                producers, producers == 1 ? "" : "s", ringNs, ringAllocations,
+                lockedNs, lockedAllocations, expected);
+  }
+}
+
+// Decodes a mix of status and sensor reports, including ones that fall
+// through to the unknown default.
+void benchReceiveDecoder(const std::string &dbPath, std::size_t iterations) {
+  sanbot::ReceiveDecoder decoder(dbPath);
+  std::vector<std::vector<uint8_t>> frames;
+  for (std::vector<uint8_t> payload : std::vector<std::vector<uint8_t>>{
+           {0x81, 0x09, 0x04, 0x35, 0x2C, 0x01, 0x90, 0x00},
+           {0x81, 0x10, 0x00, 0xC8, 0x00},
+           {0x82, 0x01, 0x10, 0x00, 0x20, 0x00, 0x30, 0x00},
+           {0x81, 0x02, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16},
+           {0x04, 0x0A, 0x03, 0x01, 0x02, 0x03},
+           {0x42, 0x00}})
+    frames.push_back(buildUsbFrame(UsbFrameParams{0x01}, payload));
+
+  std::size_t fields = 0;
+  std::size_t before = allocationCount.load();
+  auto start = Clock::now();
+  for (std::size_t i = 0; i < iterations * 10; ++i)
+    for (const auto &frame : frames)
+      fields += decoder.decode(frame).fields.size();
+  double perDecode = nanosecondsSince(start, iterations * 10 * frames.size());
+  std::printf("ReceiveDecoder::decode: %.0f ns/report, %zu allocations "
+              "(fields %zu)\n",
+              perDecode, allocationCount.load() - before, fields);
+}
+
+// Builds one report per receive case, from the first byte its
+// payload_match_expr accepts at each position with the rest of the payload
+// filled so every field is present, and decodes the whole stream. Cases that
+// share a prefix decode as the first of them, so fewer than all resolve to
+// their own id.
+void benchReceiveCases(const std::string &dbPath, std::size_t iterations) {
+  sanbot::ReceiveDecoder decoder(dbPath);
+  std::vector<std::vector<uint8_t>> frames;
+  std::vector<int> expected;
+  for (const sanbot::ReceiveCaseInfo &info : decoder.cases()) {
+    std::vector<uint8_t> payload;
+    constexpr std::string_view kStarts = "payload starts ";
+    std::string_view expr = info.matchExpr;
+    if (expr.substr(0, kStarts.size()) == kStarts) {
+      expr.remove_prefix(kStarts.size());
+      while (!expr.empty()) {
+        std::size_t end = std::min(expr.find(' '), expr.size());
+        std::string item(expr.substr(0, std::min(end, expr.find('/'))));
+        expr.remove_prefix(std::min(end + 1, expr.size()));
+        if (!item.empty())
+          payload.push_back(
+              static_cast<uint8_t>(std::strtoul(item.c_str(), nullptr, 0)));
+      }
+    } else if (!info.primaryByteHex.empty()) {
+      payload.push_back(static_cast<uint8_t>(
+          std::strtoul(info.primaryByteHex.c_str(), nullptr, 0)));
+    } else {
+      payload.push_back(0x42);
+    }
+    std::size_t length = payload.size();
+    for (const sanbot::ReceiveFieldInfo &field : info.fields)
+      length = std::max<std::size_t>(length, field.payloadOffset + 4);
+    while (payload.size() < length)
+      payload.push_back(static_cast<uint8_t>(payload.size() * 37 + 11));
+    frames.push_back(buildUsbFrame(UsbFrameParams{0x01}, payload));
+    expected.push_back(info.receiveCaseId);
+  }
+
+  std::size_t own = 0;
+  for (std::size_t i = 0; i < frames.size(); ++i)
+    own += decoder.decode(frames[i]).receiveCaseId == expected[i];
+
+  std::size_t fields = 0;
+  std::size_t before = allocationCount.load();
+  auto start = Clock::now();
+  for (std::size_t i = 0; i < iterations; ++i)
+    for (const auto &frame : frames)
+      fields += decoder.decode(frame).fields.size();
+  double elapsed = nanosecondsSince(start, 1);
+  std::printf("ReceiveDecoder, every case: %.0f ns/report, %zu allocations "
+              "(%zu cases, %zu resolve to their own id, fields %zu)\n",
+              elapsed / static_cast<double>(iterations * frames.size()),
+              allocationCount.load() - before, frames.size(), own, fields);
+}
+
+// Resolves every alias the catalogue knows, spelled as stored and as a user
+// might type it, and reports heap allocations made while resolving.
+void benchResolve(const CommandDatabase &db, std::size_t iterations) {
+  std::vector<std::string> names;
+  std::size_t ambiguous = 0;
+  for (const auto &command : db.commands()) {
+    for (const auto &alias : command.aliases) {
+      for (std::string name : {alias, "  " + alias + "!"}) {
+        for (char &c : name)
+          c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+        try {
+          db.resolveCommand(name);
+          names.push_back(name);
+        } catch (const std::exception &) {
+          ++ambiguous;
+        }
+      }
+    }
+  }
+
+  std::size_t checksum = 0;
+  std::size_t allocationsBefore = allocationCount.load();
+  auto start = Clock::now();
+  for (std::size_t i = 0; i < iterations; ++i) {
+    for (const auto &name : names)
+      checksum += db.resolveCommand(name).commandId;
+  }
+  double perResolve = nanosecondsSince(start, iterations * names.size());
+  std::size_t allocations = allocationCount.load() - allocationsBefore;
+
+  std::printf("resolveCommand: %zu names (%zu ambiguous skipped) x %zu "
+              "iterations, %.1f ns/resolve, %zu allocations (checksum %zu)\n",
+              names.size(), ambiguous, iterations, perResolve, allocations,
+              checksum);
+}
+
+void benchLoad(const char *label, const std::string &dbPath,
+               SnapshotPolicy policy, std::size_t iterations) {
+  std::size_t fromSnapshot = 0;
+  auto start = Clock::now();
+  for (std::size_t i = 0; i < iterations; ++i)
+    fromSnapshot += CommandDatabase(dbPath, policy).loadedFromSnapshot();
+  double perLoad = nanosecondsSince(start, iterations);
+
+  std::printf("load (%s): %zu iterations, %.1f us/load (%zu from snapshot)\n",
+              label, iterations, perLoad / 1000.0, fromSnapshot);
+}
+
+// Times a snapshot load against a private copy of the database so that the
+// benchmark never leaves a snapshot next to the checked-in catalogue.
+void benchSnapshotLoad(const std::string &dbPath, std::size_t iterations) {
+  namespace fs = std::filesystem;
+  fs::path copyPath = fs::temp_directory_path() /
+                      ("sanbot-bench-" + std::to_string(getpid()) + ".sqlite");
+  fs::copy_file(dbPath, copyPath, fs::copy_options::overwrite_existing);
+  std::string snapshotPath = CommandDatabase::snapshotPathFor(copyPath.string());
+  CommandDatabase(copyPath.string(), SnapshotPolicy::Ignore)
+      .writeSnapshot(snapshotPath);
+
+  benchLoad("snapshot", copyPath.string(), SnapshotPolicy::UseIfCurrent,
+            iterations);
+
+  fs::remove(snapshotPath);
+  fs::remove(copyPath);
+}
+
+void benchEmbeddedLoad(std::size_t iterations) {
+  std::size_t commands = 0;
+  auto start = Clock::now();
+  for (std::size_t i = 0; i < iterations; ++i) {
+    CommandDatabase db{sanbot::EmbeddedCatalogue{}};
+    commands += db.tables().commands.size();
+  }
+  double perLoad = nanosecondsSince(start, iterations);
+
+  std::printf("load (embedded): %zu iterations, %.3f us/load (%zu commands)\n",
+              iterations, perLoad / 1000.0, commands / iterations);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  try {
+    std::string dbPath =
+        argc > 1 ? argv[1] : CommandDatabase::findDefaultDatabasePath();
+    std::size_t iterations =
+        argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 2000;
+
+    benchLoad("sqlite", dbPath, SnapshotPolicy::Ignore, iterations / 10 + 1);
+    benchSnapshotLoad(dbPath, iterations / 10 + 1);
+    if (CommandDatabase::hasEmbeddedCatalogue())
+      benchEmbeddedLoad(iterations);
+
+    CommandDatabase db(dbPath, SnapshotPolicy::Ignore);
+    benchResolve(db, iterations);
+    benchBuildCommand(db, iterations);
+    benchRejectedBuilds(db, iterations);
+    benchScatter(db, iterations);
+    benchChecksum(iterations);
+    benchFrameParser(iterations);
+    benchSendQueue(iterations);
+    benchReceiveDecoder(dbPath, iterations);
+    benchReceiveCases(dbPath, iterations);
+    return 0;
+  } catch (const std::exception &ex) {
+    std::fprintf(stderr, "command database bench failed: %s\n", ex.what());
+    return 1;
+  }
+}
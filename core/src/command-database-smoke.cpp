@@ -1,18 +1,69 @@
+#include "byte-sum.h"
 #include "command-database.h"
 #include "control-catalogue.h"
+#include "frame-parser.h"
+#include "frame-ring.h"
 #include "packet-assembler.h"
+#include "receive-decoder.h"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <cstdio>
+#include <cstdlib>
 #include <exception>
+#include <filesystem>
+#include <memory>
+#include <new>
+#include <span>
+#include <optional>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <vector>
 
+#include <unistd.h>
+
 using sanbot::CommandArgs;
 using sanbot::CommandDatabase;
+using sanbot::SnapshotPolicy;
+
+// Known-good frames, checked when the test is compiled.
+constexpr auto kWheelDistanceFrame = appendPointTagForRouting(
+    buildUsbFrame(UsbFrameParams{0x01},
+                  std::array<uint8_t, 6>{0x01, 0x11, 0x01, 0x32, 0xE8, 0x03}),
+    0x02);
+static_assert(kWheelDistanceFrame ==
+              std::array<uint8_t, 29>{
+                  0xA4, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x01, 0x00,
+                  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xFF, 0xA5, 0x01, 0x00,
+                  0x07, 0x01, 0x11, 0x01, 0x32, 0xE8, 0x03, 0xDC, 0x02});
+
+constexpr auto kAmbientTemperatureFrame = appendPointTagForRouting(
+    buildUsbFrame(UsbFrameParams{0x01},
+                  std::array<uint8_t, 3>{0x81, 0x10, 0x00}),
+    0x01);
+static_assert(kAmbientTemperatureFrame ==
+              std::array<uint8_t, 26>{
+                  0xA4, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x09, 0x01,
+                  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xFF, 0xA5,
+                  0x01, 0x00, 0x04, 0x81, 0x10, 0x00, 0x3A, 0x01});
+
+static std::atomic<std::size_t> allocationCount{0};
+
+void *operator new(std::size_t size) {
+  allocationCount.fetch_add(1, std::memory_order_relaxed);
+  if (void *p = std::malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
 
-static bool expectEqual(const char *name, const std::vector<uint8_t> &actual,
-                        const std::vector<uint8_t> &expected) {
-  if (actual == expected)
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+
+static bool expectEqual(const char *name, std::span<const uint8_t> actual,
+                        std::span<const uint8_t> expected) {
+  if (std::ranges::equal(actual, expected))
     return true;
 
   std::fprintf(stderr, "%s packet mismatch\n", name);
@@ -26,65 +77,625 @@ static bool expectEqual(const char *name, const std::vector<uint8_t> &actual,
   return false;
 }
 
-int main(int argc, char **argv) {
+// FrameWriter must serialize into a stack buffer without touching the heap
+// and produce the same bytes as the vector-returning assembler.
+static bool checkFrameWriter() {
+  CommandPayload payload;
+  payload.commandMode = 0x02;
+  payload.orderedBytes = {0x11, 0x01, 50, -1, 0x03, static_cast<int8_t>(0xE8)};
+  std::vector<uint8_t> expected = assembleRoutedBuffer(payload, 0x01, 0x02);
+
+  std::array<uint8_t, 64> buffer;
+  std::size_t before = allocationCount.load();
+  FrameWriter writer(buffer);
+  bool written = writer.writeRoutedCommand(payload, 0x01, 0x02);
+  std::size_t allocations = allocationCount.load() - before;
+
+  if (!written || allocations != 0) {
+    std::fprintf(stderr, "FrameWriter made %zu heap allocations\n",
+                 allocations);
+    return false;
+  }
+  return expectEqual("frame writer", writer.written(), expected);
+}
+
+// Command-sized frames are copied and moved inline; larger ones spill to the
+// heap and still copy correctly.
+static bool checkFrame() {
+  std::vector<uint8_t> wheel = buildWheelDistance(0x01, 50, 1000);
+  Frame frame(wheel);
+  std::size_t before = allocationCount.load();
+  Frame copy = frame;
+  Frame moved = std::move(copy);
+  std::size_t allocations = allocationCount.load() - before;
+  if (!frame.isInline() || allocations != 0 || !(moved == frame)) {
+    std::fprintf(stderr, "inline frame copy made %zu heap allocations\n",
+                 allocations);
+    return false;
+  }
+
+  std::vector<uint8_t> block(300);
+  for (std::size_t i = 0; i < block.size(); ++i)
+    block[i] = static_cast<uint8_t>(i);
+  Frame large(block);
+  Frame largeCopy = large;
+  large.push_back(0x01);
+  if (large.isInline() || largeCopy.size() != block.size() ||
+      !std::ranges::equal(largeCopy, block) || large.back() != 0x01) {
+    std::fprintf(stderr, "heap frame did not round-trip\n");
+    return false;
+  }
+  return true;
+}
+
+// Four threads push numbered frames through a small ring while this thread
+// drains it: every frame must arrive once, in order per producer, and nothing
+// may be allocated on the way. A full ring must refuse a push.
+static bool checkFrameRing() {
+  constexpr std::size_t kProducers = 4;
+  constexpr std::size_t kPerProducer = 20000;
+  auto ring = std::make_unique<FrameRing<16>>();
+  std::vector<std::thread> producers;
+  producers.reserve(kProducers);
+
+  std::size_t before = allocationCount.load();
+  for (std::size_t p = 0; p < kProducers; ++p) {
+    producers.emplace_back([&ring, p] {
+      for (std::size_t i = 0; i < kPerProducer; ++i) {
+        Frame frame(5);
+        frame[0] = static_cast<uint8_t>(p);
+        for (std::size_t b = 0; b < 4; ++b)
+          frame[1 + b] = static_cast<uint8_t>(i >> (8 * b));
+        while (!ring->tryPush(frame))
+          std::this_thread::yield();
+      }
+    });
+  }
+
+  std::array<std::size_t, kProducers> next{};
+  bool ordered = true;
+  Frame frame;
+  for (std::size_t received = 0; received < kProducers * kPerProducer;) {
+    if (!ring->tryPop(frame)) {
+      std::this_thread::yield();
+      continue;
+    }
+    std::size_t index = 0;
+    for (std::size_t b = 0; b < 4; ++b)
+      index |= std::size_t(frame[1 + b]) << (8 * b);
+    ordered = ordered && frame[0] < kProducers && index == next[frame[0]]++;
+    ++received;
+  }
+  for (std::thread &thread : producers)
+    thread.join();
+  std::size_t allocations = allocationCount.load() - before - kProducers;
+  if (!ordered || !ring->empty() || allocations != 0) {
+    std::fprintf(stderr, "frame ring lost or reordered frames (%zu heap "
+                 "allocations)\n", allocations);
+    return false;
+  }
+
+  Frame fill(1);
+  for (std::size_t i = 0; i < FrameRing<16>::kCapacity; ++i)
+    ring->tryPush(fill);
+  if (ring->tryPush(fill) || !ring->tryPop(frame) || !ring->tryPush(fill)) {
+    std::fprintf(stderr, "frame ring did not report full\n");
+    return false;
+  }
+  return true;
+}
+
+// Each checksum kernel must agree with the portable sum at every length and
+// alignment around its block sizes, and on a buffer past 64 KiB.
+static bool checkByteSum() {
+  std::vector<uint8_t> data(70000 + 3);
+  uint32_t seed = 1;
+  for (uint8_t &byte : data) {
+    seed = seed * 1103515245 + 12345;
+    byte = static_cast<uint8_t>(seed >> 16);
+  }
+  std::span<const ByteSumKernel> kernels = availableByteSumKernels();
+  auto agree = [&](std::size_t offset, std::size_t size) {
+    uint32_t expected = kernels[0].sum(data.data() + offset, size);
+    for (const ByteSumKernel &kernel : kernels) {
+      if (kernel.sum(data.data() + offset, size) != expected) {
+        std::fprintf(stderr, "%s byte sum wrong at offset %zu size %zu\n",
+                     kernel.name, offset, size);
+        return false;
+      }
+    }
+    return true;
+  };
+  for (std::size_t offset = 0; offset < 4; ++offset)
+    for (std::size_t size = 0; size <= 300; ++size)
+      if (!agree(offset, size))
+        return false;
+  return agree(3, 70000);
+}
+
+// Frames cut into chunks of every size, with junk, a false start and a
+// corrupted frame between them, must come out whole and without allocating.
+static bool checkFrameParser() {
+  std::vector<uint8_t> payload(200);
+  for (std::size_t i = 0; i < payload.size(); ++i)
+    payload[i] = static_cast<uint8_t>(i);
+  std::vector<uint8_t> ambient = {0x81, 0x10, 0x00};
+  std::vector<uint8_t> falseStart = {0xA4};
+  std::vector<std::vector<uint8_t>> frames = {
+      buildUsbFrame(UsbFrameParams{0x01}, ambient),
+      buildUsbFrame(UsbFrameParams{0x00}, payload),
+      buildUsbFrame(UsbFrameParams{0x01}, falseStart),
+  };
+  std::vector<uint8_t> corrupt = frames[0];
+  corrupt.back() ^= 0x01;
+
+  std::vector<uint8_t> stream = {0x00, 0xA4, 0x03, 0x12};
+  stream.insert(stream.end(), frames[0].begin(), frames[0].end());
+  stream.insert(stream.end(), corrupt.begin(), corrupt.end());
+  stream.insert(stream.end(), frames[1].begin(), frames[1].end());
+  stream.push_back(0xA4);
+  stream.insert(stream.end(), frames[2].begin(), frames[2].end());
+
+  for (std::size_t chunk = 1; chunk <= stream.size(); ++chunk) {
+    UsbFrameParser parser;
+    std::size_t seen = 0;
+    bool same = true;
+    std::size_t before = allocationCount.load();
+    for (std::size_t at = 0; at < stream.size(); at += chunk) {
+      std::span<const uint8_t> bytes(stream);
+      parser.feed(bytes.subspan(at, std::min(chunk, stream.size() - at)),
+                  [&](const ReceivedFrame &frame) {
+                    same = same && seen < frames.size() &&
+                           std::ranges::equal(frame.bytes, frames[seen]);
+                    ++seen;
+                  });
+    }
+    std::size_t allocations = allocationCount.load() - before;
+    if (!same || seen != frames.size() || parser.buffered() != 0 ||
+        parser.stats().badChecksums != 1 || allocations != 0) {
+      std::fprintf(stderr,
+                   "frame parser with %zu-byte chunks found %zu frames "
+                   "(%zu allocations)\n",
+                   chunk, seen, allocations);
+      return false;
+    }
+  }
+
+  // With 255 or more payload bytes Mmnn's high byte is non-zero, and the two
+  // checksums part: the assembler adds Mmnn as a 16-bit value, the parser
+  // (like ConvertUtils.isComplete) as two bytes. Each side accepts only its
+  // own frame.
+  std::vector<uint8_t> large(300);
+  for (std::size_t i = 0; i < large.size(); ++i)
+    large[i] = static_cast<uint8_t>(i % 0xFF);
+  std::vector<uint8_t> sent = buildUsbFrame(UsbFrameParams{0x01}, large);
+  std::vector<uint8_t> received = sent;
+  received.back() = static_cast<uint8_t>(
+      sumBytes(std::span<const uint8_t>(received).subspan(
+          16, received.size() - 17)));
+  UsbFrameParser parser;
+  std::size_t parsed = 0;
+  parser.feed(sent, [&](const ReceivedFrame &) { ++parsed; });
+  std::size_t sentParsed = parsed;
+  parser.feed(received, [&](const ReceivedFrame &) { ++parsed; });
+  if (received.back() == sent.back() ||
+      validateUsbFrame(sent) != FrameStatus::Ok ||
+      validateUsbFrame(received) != FrameStatus::BadChecksum ||
+      sentParsed != 0 || parsed != 1 || parser.stats().badChecksums != 1) {
+    std::fprintf(stderr, "300-byte frame checksums were not told apart\n");
+    return false;
+  }
+  return true;
+}
+
+// Every alias must resolve to the command that lists it, unless another
+// command shares it, in which case the lookup must report the ambiguity.
+static bool checkAliases(const CommandDatabase &db) {
+  for (const auto &command : db.commands()) {
+    for (const auto &alias : command.aliases) {
+      try {
+        if (&db.resolveCommand(alias) != &command) {
+          std::fprintf(stderr, "alias %s resolved to the wrong command\n",
+                       alias.c_str());
+          return false;
+        }
+      } catch (const std::exception &ex) {
+        if (std::string(ex.what()).find("ambiguous") == std::string::npos) {
+          std::fprintf(stderr, "alias %s: %s\n", alias.c_str(), ex.what());
+          return false;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+// Failed non-throwing builds report a code and the field at fault, match the
+// throwing API's message, and do not allocate.
+static bool checkTryBuild(const CommandDatabase &db) {
+  using sanbot::BuildErrc;
+  CommandArgs tooFast{{"mode", "distance"},
+                      {"direction", "forward"},
+                      {"speed", "300"},
+                      {"distance", "1000"}};
+  auto unknown = db.tryBuildCommand("no-such-command", CommandArgs{});
+  auto outOfRange = db.tryBuildCommand("wheel", tooFast);
+  auto missing =
+      db.tryBuildCommand("wheel", CommandArgs{{"mode", "distance"}});
+  const auto &wheel = db.resolveCommand("wheel").parameters;
+  if (unknown || unknown.error().code != BuildErrc::UnknownCommand ||
+      outOfRange || outOfRange.error().code != BuildErrc::OutOfRange ||
+      outOfRange.error().field < 0 ||
+      wheel[outOfRange.error().field].fieldName.find("peed") ==
+          std::string::npos ||
+      missing || missing.error().code != BuildErrc::MissingArgument) {
+    std::fprintf(stderr, "tryBuildCommand reported the wrong errors\n");
+    return false;
+  }
+
+  // The throwing build keeps the wording it had before tryBuildCommand, which
+  // follows stoull: trailing characters read as out of range, and values
+  // without digits or beyond 64 bits as invalid.
+  struct Rejection {
+    const char *command;
+    CommandArgs args;
+    BuildErrc code;
+    const char *message;
+  };
+  auto wheelSpeed = [&](const char *speed) {
+    CommandArgs args = tooFast;
+    args["speed"] = speed;
+    return args;
+  };
+  const Rejection rejections[] = {
+      {"wheel", wheelSpeed("300"), BuildErrc::OutOfRange,
+       "out-of-range byte: 300"},
+      {"wheel", wheelSpeed("08"), BuildErrc::TrailingCharacters,
+       "out-of-range byte: 08"},
+      {"wheel", wheelSpeed("12abc"), BuildErrc::TrailingCharacters,
+       "out-of-range byte: 12abc"},
+      {"wheel", wheelSpeed("-1"), BuildErrc::OutOfRange,
+       "out-of-range byte: -1"},
+      {"wheel", wheelSpeed("fast"), BuildErrc::InvalidValue,
+       "invalid byte: fast"},
+      {"wheel", wheelSpeed("99999999999999999999"), BuildErrc::InvalidValue,
+       "invalid byte: 99999999999999999999"},
+      {"wheel", wheelSpeed(" "), BuildErrc::EmptyValue, "empty byte"},
+      {"ChangePileCommand", CommandArgs{}, BuildErrc::MissingArrayArgument,
+       "missing array argument: data"},
+      {"ChangePileCommand", CommandArgs{{"data", "1, a"}},
+       BuildErrc::InvalidValue, "invalid byte: a"},
+      {"ChangePileCommand", CommandArgs{{"data", "1, 08 "}},
+       BuildErrc::TrailingCharacters, "out-of-range byte: 08"},
+      {"ChangePileCommand", CommandArgs{{"data", ","}}, BuildErrc::EmptyArray,
+       "array argument must contain at least one byte"},
+      {"LEDLightCommand", CommandArgs{}, BuildErrc::MissingConditionArgument,
+       "missing argument needed by condition: whichLight"},
+      {"GyroscopeCommand", CommandArgs{{"DriftAngle", "08"}},
+       BuildErrc::TrailingCharacters, "out-of-range u16: 08"},
+  };
+  for (const Rejection &rejection : rejections) {
+    auto result = db.tryBuildCommand(rejection.command, rejection.args);
+    std::string message = "(built)";
+    try {
+      db.buildCommand(rejection.command, rejection.args);
+    } catch (const std::exception &ex) {
+      message = ex.what();
+    }
+    if (result || result.error().code != rejection.code ||
+        message != rejection.message) {
+      std::fprintf(stderr, "%s: expected \"%s\", got \"%s\"\n",
+                   rejection.command, rejection.message, message.c_str());
+      return false;
+    }
+  }
+
+  auto prepared =
+      db.prepare("wheel", {"mode", "direction", "speed", "distance"});
+  auto built = prepared.tryBuild(0x11, 0x01, 50, 1000);
+  if (!built || !expectEqual("wheel distance (tryBuild)", built->bytes,
+                             prepared.build(0x11, 0x01, 50, 1000).bytes))
+    return false;
+  // build runs in the same per-thread scratch as tryBuild, so once warm it
+  // allocates no more than the returned BuiltCommand needs.
+  std::size_t before = allocationCount.load();
+  auto warm = prepared.build(0x11, 0x01, 50, 1000);
+  std::size_t buildAllocations = allocationCount.load() - before;
+  if (buildAllocations != 0 || !warm.bytes.isInline()) {
+    std::fprintf(stderr, "prepared build made %zu heap allocations\n",
+                 buildAllocations);
+    return false;
+  }
+  before = allocationCount.load();
+  auto rejected = prepared.tryBuild(0x11, 0x01, 300, 1000);
+  std::size_t allocations = allocationCount.load() - before;
+  if (rejected || rejected.error().code != BuildErrc::OutOfRange ||
+      rejected.error().argument != 2 || allocations != 0) {
+    std::fprintf(stderr,
+                 "prepared tryBuild rejected speed 300 with %zu allocations\n",
+                 allocations);
+    return false;
+  }
+  return true;
+}
+
+static bool checkDatabase(const CommandDatabase &db) {
+  if (db.commands().size() < 80) {
+    std::fprintf(stderr, "expected at least 80 commands, got %zu\n",
+                 db.commands().size());
+    return false;
+  }
+  if (!checkAliases(db) || !checkTryBuild(db))
+    return false;
+
+  auto wheelDistance = db.buildCommand(
+      "wheel", CommandArgs{{"mode", "distance"},
+                           {"direction", "forward"},
+                           {"speed", "50"},
+                           {"distance", "1000"}});
+  if (!expectEqual("wheel distance", wheelDistance.wireBytes(),
+                   buildWheelDistance(0x01, 50, 1000)) ||
+      !expectEqual("wheel distance (constant)",
+                   wheelDistance.wireBytes(),
+                   kWheelDistanceFrame))
+    return false;
+
+  // The same build through pre-bound argument slots.
+  std::vector<std::optional<std::string_view>> wheelSlots(
+      db.argumentSlotCount("wheel"));
+  for (const auto &[key, value] :
+       CommandArgs{{"Mode", "distance"},
+                   {"direction", "forward"},
+                   {"speed", "50"},
+                   {"distance", "1000"}}) {
+    auto slot = db.argumentSlot("wheel", key);
+    if (!slot) {
+      std::fprintf(stderr, "wheel has no argument slot for %s\n", key.c_str());
+      return false;
+    }
+    wheelSlots[*slot] = value;
+  }
+  if (!expectEqual("wheel distance (slots)",
+                   db.buildCommand("wheel", sanbot::ArgumentSlots(wheelSlots))
+                       .bytes,
+                   wheelDistance.bytes))
+    return false;
+
+  auto preparedWheel =
+      db.prepare("wheel", {"mode", "direction", "speed", "distance"});
+  if (!expectEqual("wheel distance (prepared)",
+                   preparedWheel.build(0x11, 0x01, 50, 1000).bytes,
+                   wheelDistance.bytes))
+    return false;
+
+  // A changed speed patches the kept frame; it must match a fresh build.
+  sanbot::FrameTemplate wheelFrame(preparedWheel);
+  wheelFrame.update(0x11, 0x01, 50, 1000);
+  const auto &patchedWheel = wheelFrame.update(0x11, 0x01, 70, 1200);
+  if (!wheelFrame.lastUpdatePatched()) {
+    std::fprintf(stderr, "wheel frame template was rebuilt, not patched\n");
+    return false;
+  }
+  if (!expectEqual("wheel distance (template)", patchedWheel.wireBytes(),
+                   buildWheelDistance(0x01, 70, 1200)))
+    return false;
+
+  auto wheelTimed = db.buildCommand(
+      "wheel", CommandArgs{{"mode", "timed"},
+                           {"direction", "right"},
+                           {"time", "500"},
+                           {"degree", "45"}});
+  if (!expectEqual("wheel timed", wheelTimed.wireBytes(),
+                   buildWheelTimed(0x04, 500, 45)))
+    return false;
+
+  auto armNoAngle = db.buildCommand("arm",
+                                    CommandArgs{{"mode", "no-angle"},
+                                                {"hand", "left"},
+                                                {"speed", "40"},
+                                                {"action", "up"}});
+  if (!expectEqual("arm no-angle", armNoAngle.wireBytes(),
+                   buildArmNoAngle(0x01, 40, 0x01)))
+    return false;
+
+  auto headLocate = db.buildCommand(
+      "head", CommandArgs{{"mode", "locate-absolute"},
+                          {"lock", "both-lock"},
+                          {"horizontal-degree", "30"},
+                          {"vertical-degree", "20"}});
+  if (!expectEqual("head locate absolute", headLocate.wireBytes(),
+                   buildHeadLocateAbsolute(0x03, 30, 20)))
+    return false;
+
+  auto ambientTemperature =
+      db.buildCommand("ambient-temperature", CommandArgs{});
+  CommandPayload ambientPayload;
+  ambientPayload.commandMode = 0x81;
+  ambientPayload.orderedBytes = {0x10, 0x00};
+  if (!expectEqual("ambient temperature", ambientTemperature.bytes,
+                   assembleUsbFrameFromCommand(ambientPayload, 0x01)) ||
+      ambientTemperature.routeTag != 0x01 ||
+      !expectEqual("ambient temperature (routed)",
+                   ambientTemperature.wireBytes(),
+                   assembleRoutedBuffer(ambientPayload, 0x01, 0x01)) ||
+      !expectEqual("ambient temperature (constant)",
+                   ambientTemperature.wireBytes(), kAmbientTemperatureFrame))
+    return false;
+
+  std::vector<sanbot::CommandRequest> requests = {
+      {"wheel", CommandArgs{{"mode", "timed"},
+                            {"direction", "right"},
+                            {"time", "500"},
+                            {"degree", "45"}}},
+      {"wheel", CommandArgs{{"mode", "timed"}}},
+      {"ambient-temperature", CommandArgs{}},
+  };
+  sanbot::CommandBatch batch = db.buildBatch(requests);
+  if (batch.frames.size() != 3 || !batch.frames[0].ok ||
+      batch.frames[1].ok || batch.frames[1].length != 0 ||
+      !batch.frames[2].ok ||
+      batch.bytes.size() !=
+          wheelTimed.bytes.size() + ambientTemperature.bytes.size()) {
+    std::fprintf(stderr, "batch build produced the wrong layout\n");
+    return false;
+  }
+  if (!expectEqual("batch wheel timed", batch.frame(0),
+                   wheelTimed.bytes) ||
+      !expectEqual("batch ambient temperature", batch.frame(2),
+                   ambientTemperature.bytes))
+    return false;
+
+  // Failed requests carry a BuildError; rebuilding a warmed batch with
+  // failures neither throws nor allocates.
+  requests.push_back({"no-such-command", CommandArgs{}});
+  db.buildBatch(requests, batch);
+  std::size_t before = allocationCount.load();
+  db.buildBatch(requests, batch);
+  std::size_t allocations = allocationCount.load() - before;
+  std::string missingMessage;
   try {
-    std::string dbPath =
-        argc > 1 ? argv[1] : CommandDatabase::findDefaultDatabasePath();
-    CommandDatabase db(dbPath);
+    db.buildCommand("wheel", requests[1].args);
+  } catch (const std::exception &ex) {
+    missingMessage = ex.what();
+  }
+  if (batch.frames.size() != 4 ||
+      batch.frames[1].error.code != sanbot::BuildErrc::MissingArgument ||
+      batch.frames[3].ok ||
+      batch.frames[3].error.code != sanbot::BuildErrc::UnknownCommand ||
+      db.buildErrorMessage(requests[1]) != missingMessage ||
+      db.buildErrorMessage(requests[3]) != "unknown command: no-such-command" ||
+      !db.buildErrorMessage(requests[0]).empty() || allocations != 0) {
+    std::fprintf(stderr, "batch misreported failures (%zu heap allocations, "
+                 "\"%s\")\n", allocations,
+                 db.buildErrorMessage(requests[1]).c_str());
+    return false;
+  }
 
-    if (db.commands().size() < 80) {
-      std::fprintf(stderr, "expected at least 80 commands, got %zu\n",
-                   db.commands().size());
-      return 1;
+  Frame corrupt = wheelDistance.bytes;
+  corrupt[FrameWriter::headerSize()] ^= 0x01;
+  if (validateUsbFrame(wheelDistance.bytes) != FrameStatus::Ok ||
+      validateUsbFrame(corrupt) != FrameStatus::BadChecksum ||
+      validateUsbFrame(wheelDistance.wireBytes()) != FrameStatus::BadLength) {
+    std::fprintf(stderr, "frame validation misjudged the wheel frame\n");
+    return false;
+  }
+
+  // A borrowed array is framed in place unless it holds 0xFF, which the
+  // assembler drops and so has to be copied.
+  std::vector<uint8_t> zigbeeData(200);
+  for (std::size_t i = 0; i < zigbeeData.size(); ++i)
+    zigbeeData[i] = static_cast<uint8_t>(i);
+  for (bool withFF : {false, true}) {
+    if (withFF)
+      zigbeeData.push_back(0xFF);
+    std::string text;
+    for (uint8_t byte : zigbeeData)
+      text += std::to_string(byte) + ",";
+    auto zigbee = db.buildScatterCommand("ZigbeeCommand", CommandArgs{},
+                                         zigbeeData);
+    if ((zigbee.frame.payload.data() == zigbeeData.data()) == withFF) {
+      std::fprintf(stderr, "zigbee scatter frame borrowed the wrong payload\n");
+      return false;
     }
+    if (validateUsbFrame(zigbee.frame.gather()) != FrameStatus::Ok ||
+        !expectEqual(withFF ? "zigbee scatter (0xFF)" : "zigbee scatter",
+                     zigbee.frame.gather(),
+                     db.buildCommand("ZigbeeCommand",
+                                     CommandArgs{{"data", text}})
+                         .bytes))
+      return false;
+  }
+  return true;
+}
 
-    auto wheelDistance = db.buildCommand(
-        "wheel", CommandArgs{{"mode", "distance"},
-                             {"direction", "forward"},
-                             {"speed", "50"},
-                             {"distance", "1000"}});
-    if (!expectEqual("wheel distance", wheelDistance.bytes,
-                     buildWheelDistance(0x01, 50, 1000)))
-      return 1;
+// Decodes reports built by hand: the longest matching prefix wins, B fields
+// are signed like Java bytes, and unmatched payloads fall to the default.
+static bool checkReceiveDecoder(const std::string &dbPath) {
+  sanbot::ReceiveDecoder decoder(dbPath);
+  using Fields = std::vector<std::pair<std::string_view, int32_t>>;
+  auto expect = [&](std::vector<uint8_t> payload, std::string_view className,
+                    Fields fields) {
+    const sanbot::DecodedEvent &event =
+        decoder.decode(buildUsbFrame(UsbFrameParams{0x01}, payload));
+    bool same = event.className == className &&
+                event.fields.size() == fields.size();
+    for (std::size_t i = 0; same && i < fields.size(); ++i)
+      same = event.fields[i].name == fields[i].first &&
+             event.fields[i].value == fields[i].second;
+    if (!same)
+      std::fprintf(stderr, "report decoded as %.*s with %zu fields\n",
+                   static_cast<int>(event.className.size()),
+                   event.className.data(), event.fields.size());
+    return same;
+  };
+  return expect({0x81, 0x09, 0x04, 0x35, 0x2C, 0x01, 0x90, 0x00},
+                "HeadLocation",
+                {{"whichPart", 4},
+                 {"status", 5},
+                 {"speed", 3},
+                 {"horizontalAngle", 300},
+                 {"verticalAngle", 144}}) &&
+         expect({0x81, 0x09, 0x01, 0xF2}, "QueryMovementStatus",
+                {{"which_part", 1}, {"status", 2}, {"speed", 15}}) &&
+         expect({0x81, 0x10, 0x00, 0xC8, 0x00}, "AmbientTemperature",
+                {{"LSBTemperature", -56}, {"MSBTemperature", 0}}) &&
+         expect({0x81, 0x10}, "QueryBatteryCommand", {}) &&
+         expect({0x42}, "Command", {});
+}
 
-    auto wheelTimed = db.buildCommand(
-        "wheel", CommandArgs{{"mode", "timed"},
-                             {"direction", "right"},
-                             {"time", "500"},
-                             {"degree", "45"}});
-    if (!expectEqual("wheel timed", wheelTimed.bytes,
-                     buildWheelTimed(0x04, 500, 45)))
-      return 1;
+// Writes a snapshot for a private copy of the database and checks that the
+// mapped catalogue builds the same packets.
+static bool checkSnapshot(const std::string &dbPath, std::size_t commands) {
+  namespace fs = std::filesystem;
+  fs::path copyPath = fs::temp_directory_path() /
+                      ("sanbot-smoke-" + std::to_string(getpid()) + ".sqlite");
+  fs::copy_file(dbPath, copyPath, fs::copy_options::overwrite_existing);
+  std::string snapshotPath =
+      CommandDatabase::snapshotPathFor(copyPath.string());
+  CommandDatabase(copyPath.string(), SnapshotPolicy::Ignore)
+      .writeSnapshot(snapshotPath);
+  CommandDatabase mapped(copyPath.string());
+  bool ok = mapped.loadedFromSnapshot() && checkDatabase(mapped) &&
+            mapped.commands().size() == commands;
+  fs::remove(snapshotPath);
+  fs::remove(copyPath);
+  if (!ok)
+    std::fprintf(stderr, "snapshot catalogue did not match the database\n");
+  return ok;
+}
 
-    auto armNoAngle = db.buildCommand("arm",
-                                      CommandArgs{{"mode", "no-angle"},
-                                                  {"hand", "left"},
-                                                  {"speed", "40"},
-                                                  {"action", "up"}});
-    if (!expectEqual("arm no-angle", armNoAngle.bytes,
-                     buildArmNoAngle(0x01, 40, 0x01)))
+int main(int argc, char **argv) {
+  try {
+    if (!checkFrameWriter() || !checkFrame() || !checkFrameRing() ||
+        !checkByteSum() || !checkFrameParser())
       return 1;
 
-    auto headLocate = db.buildCommand(
-        "head", CommandArgs{{"mode", "locate-absolute"},
-                            {"lock", "both-lock"},
-                            {"horizontal-degree", "30"},
-                            {"vertical-degree", "20"}});
-    if (!expectEqual("head locate absolute", headLocate.bytes,
-                     buildHeadLocateAbsolute(0x03, 30, 20)))
-      return 1;
+    std::size_t commands = 0;
+    if (CommandDatabase::hasEmbeddedCatalogue()) {
+      CommandDatabase embedded{sanbot::EmbeddedCatalogue{}};
+      if (!checkDatabase(embedded))
+        return 1;
+      commands = embedded.commands().size();
+    }
 
-    auto ambientTemperature =
-        db.buildCommand("ambient-temperature", CommandArgs{});
-    CommandPayload ambientPayload;
-    ambientPayload.commandMode = 0x81;
-    ambientPayload.orderedBytes = {0x10, 0x00};
-    if (!expectEqual("ambient temperature", ambientTemperature.bytes,
-                     assembleRoutedBuffer(ambientPayload, 0x01, 0x01)))
-      return 1;
+    if (argc > 1 || commands == 0) {
+      std::string dbPath =
+          argc > 1 ? argv[1] : CommandDatabase::findDefaultDatabasePath();
+      CommandDatabase db(dbPath, SnapshotPolicy::Ignore);
+      if (!checkDatabase(db))
+        return 1;
+      if (commands != 0 && commands != db.commands().size()) {
+        std::fprintf(stderr, "embedded catalogue has %zu commands, database "
+                     "has %zu\n", commands, db.commands().size());
+        return 1;
+      }
+      commands = db.commands().size();
+      if (!checkSnapshot(dbPath, commands) || !checkReceiveDecoder(dbPath))
+        return 1;
+    }
 
     std::printf("command database smoke test passed (%zu commands)\n",
-                db.commands().size());
+                commands);
     return 0;
   } catch (const std::exception &ex) {
     std::fprintf(stderr, "command database smoke test failed: %s\n",
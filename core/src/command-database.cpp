@@ -1,19 +1,43 @@
 #include "command-database.h"
 
+#include "catalogue-snapshot.h"
+#include "catalogue-sqlite.h"
+#include "embedded-catalogue.h"
 #include "packet-assembler.h"
 
 #include <algorithm>
+#include <array>
+#include <bit>
 #include <cctype>
+#include <charconv>
 #include <cstdlib>
 #include <filesystem>
+#include <mutex>
 #include <set>
+#include <span>
 #include <sstream>
 #include <stdexcept>
 #include <unordered_map>
 
-#include <sqlite3.h>
-
 namespace sanbot {
+
+// What a numeric build did with its arguments, recorded for FrameTemplate.
+// Slots are argument slots of the command's plan.
+struct FrameTrace {
+  struct PayloadByte {
+    int32_t source = -1;
+    uint8_t shift = 0;
+    uint8_t value = 0;
+  };
+
+  uint8_t commandMode = 0;
+  uint64_t structural = 0;
+  std::array<int64_t, kMaxArgumentSlots> limits;
+  std::vector<PayloadByte> payload;
+
+  FrameTrace() { limits.fill(INT64_MAX); }
+};
+
 namespace {
 
 namespace fs = std::filesystem;
@@ -35,133 +59,238 @@ void stripSuffix(std::string &s, const std::string &suffix) {
     s.erase(s.size() - suffix.size());
 }
 
-std::string normalizeKey(const std::string &s) {
+// Lowercase ASCII letters and digits; 0 for everything normalizeKey drops.
+// The CLI never changes locale, so this matches isalnum/tolower in "C".
+constexpr std::array<char, 256> kKeyChars = [] {
+  std::array<char, 256> table{};
+  for (int c = '0'; c <= '9'; ++c)
+    table[c] = static_cast<char>(c);
+  for (int c = 'a'; c <= 'z'; ++c) {
+    table[c] = static_cast<char>(c);
+    table[c - 'a' + 'A'] = static_cast<char>(c);
+  }
+  return table;
+}();
+
+std::string normalizeKey(std::string_view s) {
   std::string out;
   out.reserve(s.size());
   for (unsigned char c : s) {
-    if (std::isalnum(c))
-      out.push_back(static_cast<char>(std::tolower(c)));
+    if (char k = kKeyChars[c])
+      out.push_back(k);
   }
   return out;
 }
 
-void addUnique(std::vector<std::string> &values, const std::string &value) {
-  if (value.empty())
-    return;
-  if (std::find(values.begin(), values.end(), value) == values.end())
-    values.push_back(value);
-}
-
-bool isSimpleIdentifier(const std::string &s) {
-  if (s.empty())
-    return false;
+// Alias hashing works on the normalized form without building it, so that a
+// lookup can hash and compare the caller's spelling in place.
+uint64_t hashNormalizedKey(std::string_view s) {
+  uint64_t hash = 0xCBF29CE484222325ull;
   for (unsigned char c : s) {
-    if (!std::isalnum(c) && c != '_')
-      return false;
+    if (char k = kKeyChars[c]) {
+      hash ^= static_cast<unsigned char>(k);
+      hash *= 0x100000001B3ull;
+    }
   }
-  return true;
+  return hash;
 }
 
-uint64_t parseUnsigned(const std::string &text, uint64_t maxValue,
-                       const std::string &what) {
-  std::string s = trim(text);
-  if (s.empty())
-    throw std::runtime_error("empty " + what);
-
-  std::size_t consumed = 0;
-  unsigned long long value = 0;
-  try {
-    value = std::stoull(s, &consumed, 0);
-  } catch (...) {
-    throw std::runtime_error("invalid " + what + ": " + text);
-  }
-  if (consumed != s.size() || value > maxValue)
-    throw std::runtime_error("out-of-range " + what + ": " + text);
-  return static_cast<uint64_t>(value);
+uint32_t seededSlotHash(uint64_t hash, uint32_t seed) {
+  hash ^= seed * 0x9E3779B97F4A7C15ull;
+  hash ^= hash >> 33;
+  hash *= 0xFF51AFD7ED558CCDull;
+  hash ^= hash >> 33;
+  return static_cast<uint32_t>(hash);
 }
 
-uint8_t parseByteLiteral(const std::string &text) {
-  return static_cast<uint8_t>(parseUnsigned(text, 0xFF, "byte"));
+uint32_t aliasBucket(uint64_t hash, std::size_t bucketCount) {
+  return static_cast<uint32_t>(hash >> 32) &
+         static_cast<uint32_t>(bucketCount - 1);
 }
 
-uint16_t parseU16Literal(const std::string &text) {
-  return static_cast<uint16_t>(parseUnsigned(text, 0xFFFF, "u16"));
+bool equalsNormalizedKey(std::string_view raw, std::string_view key) {
+  std::size_t matched = 0;
+  for (unsigned char c : raw) {
+    char k = kKeyChars[c];
+    if (!k)
+      continue;
+    if (matched == key.size() || key[matched] != k)
+      return false;
+    ++matched;
+  }
+  return matched == key.size();
 }
 
-std::vector<uint8_t> parseByteList(const std::string &text) {
-  std::vector<uint8_t> bytes;
-  std::stringstream ss(text);
-  std::string token;
-  while (std::getline(ss, token, ',')) {
-    token = trim(token);
-    if (!token.empty())
-      bytes.push_back(parseByteLiteral(token));
+// Orders the normalized form of raw against an already normalized key.
+int compareNormalizedKey(std::string_view raw, std::string_view key) {
+  std::size_t matched = 0;
+  for (unsigned char c : raw) {
+    char k = kKeyChars[c];
+    if (!k)
+      continue;
+    if (matched == key.size())
+      return 1;
+    if (k != key[matched])
+      return k < key[matched] ? -1 : 1;
+    ++matched;
   }
-  if (bytes.empty())
-    throw std::runtime_error("array argument must contain at least one byte");
-  return bytes;
+  return matched == key.size() ? 0 : -1;
 }
 
-std::string sqliteText(sqlite3_stmt *stmt, int column) {
-  const unsigned char *text = sqlite3_column_text(stmt, column);
-  return text ? reinterpret_cast<const char *>(text) : "";
+int32_t findAlias(const CatalogueTables &tables, std::string_view name) {
+  if (tables.aliasSeeds.empty())
+    return -1;
+  uint64_t hash = hashNormalizedKey(name);
+  uint32_t seed = tables.aliasSeeds[aliasBucket(hash, tables.aliasSeeds.size())];
+  uint32_t slot = tables.aliasSlots[seededSlotHash(hash, seed) &
+                                    (tables.aliasSlots.size() - 1)];
+  if (slot == kEmptyAliasSlot ||
+      !equalsNormalizedKey(name, tables.textOf(tables.aliases[slot].key)))
+    return -1;
+  return static_cast<int32_t>(slot);
 }
 
-struct SQLiteHandle {
-  sqlite3 *db = nullptr;
-
-  explicit SQLiteHandle(const std::string &path) {
-    if (sqlite3_open_v2(path.c_str(), &db, SQLITE_OPEN_READONLY, nullptr) !=
-        SQLITE_OK) {
-      std::string message = db ? sqlite3_errmsg(db) : "sqlite open failed";
-      if (db)
-        sqlite3_close(db);
-      db = nullptr;
-      throw std::runtime_error("failed to open command database '" + path +
-                               "': " + message);
+std::optional<uint8_t> findValueAlias(const CatalogueTables &tables,
+                                      PlanRange range, std::string_view raw) {
+  const ValueAliasRecord *first = tables.valueAliases.data() + range.begin;
+  std::size_t count = range.count;
+  while (count > 0) {
+    std::size_t half = count / 2;
+    int order = compareNormalizedKey(raw, tables.textOf(first[half].name));
+    if (order == 0)
+      return first[half].value;
+    if (order > 0) {
+      first += half + 1;
+      count -= half + 1;
+    } else {
+      count = half;
     }
   }
+  return std::nullopt;
+}
 
-  ~SQLiteHandle() {
-    if (db)
-      sqlite3_close(db);
+// Slot of an argument name among a command's sorted argument keys, or -1.
+int32_t findArgumentSlot(const CatalogueTables &tables, PlanRange keys,
+                         std::string_view name) {
+  const TextRef *first = tables.argumentKeys.data() + keys.begin;
+  std::size_t lo = 0;
+  std::size_t hi = keys.count;
+  while (lo < hi) {
+    std::size_t mid = lo + (hi - lo) / 2;
+    int order = compareNormalizedKey(name, tables.textOf(first[mid]));
+    if (order == 0)
+      return static_cast<int32_t>(mid);
+    if (order > 0)
+      lo = mid + 1;
+    else
+      hi = mid;
   }
+  return -1;
+}
 
-  SQLiteHandle(const SQLiteHandle &) = delete;
-  SQLiteHandle &operator=(const SQLiteHandle &) = delete;
-};
-
-struct Statement {
-  sqlite3_stmt *stmt = nullptr;
+void addUnique(std::vector<std::string> &values, const std::string &value) {
+  if (value.empty())
+    return;
+  if (std::find(values.begin(), values.end(), value) == values.end())
+    values.push_back(value);
+}
 
-  Statement(sqlite3 *db, const std::string &sql) {
-    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
-      throw std::runtime_error("sqlite prepare failed: " +
-                               std::string(sqlite3_errmsg(db)));
+bool isSimpleIdentifier(const std::string &s) {
+  if (s.empty())
+    return false;
+  for (unsigned char c : s) {
+    if (!std::isalnum(c) && c != '_')
+      return false;
   }
+  return true;
+}
 
-  ~Statement() {
-    if (stmt)
-      sqlite3_finalize(stmt);
+std::string_view trimView(std::string_view text) {
+  auto space = [](char c) {
+    return std::isspace(static_cast<unsigned char>(c)) != 0;
+  };
+  while (!text.empty() && space(text.front()))
+    text.remove_prefix(1);
+  while (!text.empty() && space(text.back()))
+    text.remove_suffix(1);
+  return text;
+}
+
+// Parses an unsigned literal exactly as stoull does with base 0 (0x for hex,
+// a leading 0 for octal, a minus sign negating modulo 2^64), ignoring
+// surrounding whitespace. Neither throws nor allocates, so failed builds stay
+// cheap.
+BuildErrc parseUnsignedValue(std::string_view text, uint64_t maxValue,
+                             uint64_t &value) {
+  text = trimView(text);
+  if (text.empty())
+    return BuildErrc::EmptyValue;
+  bool negative = text.front() == '-';
+  if (negative || text.front() == '+')
+    text.remove_prefix(1);
+
+  int base = 10;
+  if (text.size() > 2 && text[0] == '0' && (text[1] == 'x' || text[1] == 'X') &&
+      std::isxdigit(static_cast<unsigned char>(text[2]))) {
+    base = 16;
+    text.remove_prefix(2);
+  } else if (!text.empty() && text[0] == '0') {
+    base = 8;
   }
+  const char *end = text.data() + text.size();
+  auto [stop, ec] = std::from_chars(text.data(), end, value, base);
+  // stoull throws for both, and both were reported as invalid.
+  if (ec == std::errc::invalid_argument ||
+      ec == std::errc::result_out_of_range)
+    return BuildErrc::InvalidValue;
+  if (negative)
+    value = 0 - value;
+  if (stop != end)
+    return BuildErrc::TrailingCharacters;
+  return value > maxValue ? BuildErrc::OutOfRange : BuildErrc::Ok;
+}
 
-  Statement(const Statement &) = delete;
-  Statement &operator=(const Statement &) = delete;
+std::string valueErrorMessage(BuildErrc code, std::string_view what,
+                              std::string_view text) {
+  std::string kind(what);
+  if (code == BuildErrc::EmptyValue)
+    return "empty " + kind;
+  if (code == BuildErrc::OutOfRange || code == BuildErrc::TrailingCharacters)
+    return "out-of-range " + kind + ": " + std::string(text);
+  return "invalid " + kind + ": " + std::string(text);
+}
 
-  void bindInt(int index, int value) {
-    if (sqlite3_bind_int(stmt, index, value) != SQLITE_OK)
-      throw std::runtime_error("sqlite bind failed");
-  }
+uint8_t parseByteLiteral(std::string_view text) {
+  uint64_t value = 0;
+  BuildErrc code = parseUnsignedValue(text, 0xFF, value);
+  if (code != BuildErrc::Ok)
+    throw std::runtime_error(valueErrorMessage(code, "byte", text));
+  return static_cast<uint8_t>(value);
+}
 
-  bool step() {
-    int rc = sqlite3_step(stmt);
-    if (rc == SQLITE_ROW)
-      return true;
-    if (rc == SQLITE_DONE)
-      return false;
-    throw std::runtime_error("sqlite step failed");
+// Appends the comma-separated bytes of text to out; on failure out is left
+// as it was and bad is the rejected element, trimmed.
+BuildErrc appendByteList(std::string_view text, std::vector<uint8_t> &out,
+                         std::string_view &bad) {
+  std::size_t before = out.size();
+  while (true) {
+    std::size_t comma = text.find(',');
+    std::string_view element = trimView(text.substr(0, comma));
+    uint64_t value = 0;
+    BuildErrc code = parseUnsignedValue(element, 0xFF, value);
+    if (code == BuildErrc::Ok) {
+      out.push_back(static_cast<uint8_t>(value));
+    } else if (code != BuildErrc::EmptyValue) {
+      out.resize(before);
+      bad = element;
+      return code;
+    }
+    if (comma == std::string_view::npos)
+      break;
+    text.remove_prefix(comma + 1);
   }
-};
+  return out.size() == before ? BuildErrc::EmptyArray : BuildErrc::Ok;
+}
 
 std::string friendlyAlias(const std::string &canonicalName) {
   std::string s = canonicalName;
@@ -185,26 +314,8 @@ std::vector<std::string> generatedAliasesFor(const CommandInfo &command) {
   return aliases;
 }
 
-struct ArgumentBag {
-  std::map<std::string, std::string> values;
-
-  explicit ArgumentBag(const CommandArgs &args) {
-    for (const auto &[key, value] : args)
-      values[normalizeKey(key)] = value;
-  }
-
-  std::optional<std::string> find(const std::vector<std::string> &keys) const {
-    for (const auto &key : keys) {
-      auto it = values.find(normalizeKey(key));
-      if (it != values.end())
-        return it->second;
-    }
-    return std::nullopt;
-  }
-};
-
 std::string stripMotionPrefix(std::string s) {
-  for (const std::string &prefix : {"moveWheel", "moveHand", "moveHead"}) {
+  for (std::string_view prefix : {"moveWheel", "moveHand", "moveHead"}) {
     if (s.rfind(prefix, 0) == 0) {
       s.erase(0, prefix.size());
       return s;
@@ -305,186 +416,460 @@ std::vector<std::string> argumentKeysForField(const CommandParameter &field) {
   return keys;
 }
 
-std::optional<uint8_t> valueAlias(const std::string &fieldName,
-                                  const std::string &rawValue) {
-  std::string field = normalizeKey(fieldName);
-  std::string value = normalizeKey(rawValue);
-  std::map<std::string, uint8_t> aliases;
+struct ValueAliasEntry {
+  const char *name;
+  uint8_t value;
+};
 
-  auto add = [&](const std::string &name, uint8_t byte) {
-    aliases[normalizeKey(name)] = byte;
-  };
+constexpr ValueAliasEntry kSwitchValues[] = {
+    {"off", 0x00},    {"disable", 0x00}, {"disabled", 0x00}, {"false", 0x00},
+    {"on", 0x01},     {"enable", 0x01},  {"enabled", 0x01},  {"true", 0x01},
+};
 
-  if (field.find("switch") != std::string::npos ||
-      field.find("status") != std::string::npos) {
-    add("off", 0x00);
-    add("disable", 0x00);
-    add("disabled", 0x00);
-    add("false", 0x00);
-    add("on", 0x01);
-    add("enable", 0x01);
-    add("enabled", 0x01);
-    add("true", 0x01);
-  }
-
-  if (field == "movewheeldirection") {
-    add("stop", 0x00);
-    add("forward", 0x01);
-    add("back", 0x02);
-    add("backward", 0x02);
-    add("left", 0x03);
-    add("right", 0x04);
-    add("left-forward", 0x05);
-    add("right-forward", 0x06);
-    add("left-back", 0x07);
-    add("right-back", 0x08);
-    add("left-translation", 0x0A);
-    add("right-translation", 0x0B);
-    add("turn-left", 0x0C);
-    add("turn-right", 0x0D);
-    add("stop-turn", 0xF0);
-  }
-
-  if (field == "whichhand") {
-    add("left", 0x01);
-    add("right", 0x02);
-    add("both", 0x03);
-  }
-
-  if (field == "movehanddirection") {
-    add("up", 0x01);
-    add("down", 0x02);
-    add("stop", 0x03);
-    add("reset", 0x04);
-  }
-
-  if (field == "moveheaddirection") {
-    add("stop", 0x00);
-    add("up", 0x01);
-    add("vertical", 0x01);
-    add("horizontal-lock", 0x01);
-    add("down", 0x02);
-    add("horizontal", 0x02);
-    add("vertical-lock", 0x02);
-    add("left", 0x03);
-    add("both-lock", 0x03);
-    add("right", 0x04);
-    add("left-up", 0x05);
-    add("right-up", 0x06);
-    add("left-down", 0x07);
-    add("right-down", 0x08);
-    add("vertical-reset", 0x09);
-    add("horizontal-reset", 0x0A);
-    add("centre-reset", 0x0B);
-    add("center-reset", 0x0B);
-    add("no-lock", 0x00);
-  }
-
-  if (field.find("relative_direction") != std::string::npos ||
-      field.find("relativedirection") != std::string::npos) {
-    add("left", 0x01);
-    add("up", 0x01);
-    add("right", 0x02);
-    add("down", 0x02);
-  }
-
-  if (field.find("mode") != std::string::npos) {
-    add("no-angle", 0x01);
-    add("direct", 0x01);
-    add("relative", 0x02);
-    add("absolute", 0x03);
-    add("timed", 0x10);
-    add("time", 0x10);
-    add("distance", 0x11);
-    add("centre", 0x20);
-    add("center", 0x20);
-    add("locate-absolute", 0x21);
-    add("locate-relative", 0x22);
-  }
-
-  auto it = aliases.find(value);
-  if (it == aliases.end())
-    return std::nullopt;
-  return it->second;
-}
+constexpr ValueAliasEntry kWheelDirectionValues[] = {
+    {"stop", 0x00},
+    {"forward", 0x01},
+    {"back", 0x02},
+    {"backward", 0x02},
+    {"left", 0x03},
+    {"right", 0x04},
+    {"left-forward", 0x05},
+    {"right-forward", 0x06},
+    {"left-back", 0x07},
+    {"right-back", 0x08},
+    {"left-translation", 0x0A},
+    {"right-translation", 0x0B},
+    {"turn-left", 0x0C},
+    {"turn-right", 0x0D},
+    {"stop-turn", 0xF0},
+};
 
-struct BuildContext {
-  std::unordered_map<std::string, uint64_t> values;
+constexpr ValueAliasEntry kHandValues[] = {
+    {"left", 0x01},
+    {"right", 0x02},
+    {"both", 0x03},
+};
 
-  void set(const std::string &name, uint64_t value) {
-    if (!name.empty())
-      values[normalizeKey(name)] = value;
-  }
+constexpr ValueAliasEntry kHandDirectionValues[] = {
+    {"up", 0x01},
+    {"down", 0x02},
+    {"stop", 0x03},
+    {"reset", 0x04},
+};
 
-  std::optional<uint64_t> get(const std::string &name) const {
-    auto it = values.find(normalizeKey(name));
-    if (it == values.end())
-      return std::nullopt;
-    return it->second;
-  }
+constexpr ValueAliasEntry kHeadDirectionValues[] = {
+    {"stop", 0x00},
+    {"up", 0x01},
+    {"vertical", 0x01},
+    {"horizontal-lock", 0x01},
+    {"down", 0x02},
+    {"horizontal", 0x02},
+    {"vertical-lock", 0x02},
+    {"left", 0x03},
+    {"both-lock", 0x03},
+    {"right", 0x04},
+    {"left-up", 0x05},
+    {"right-up", 0x06},
+    {"left-down", 0x07},
+    {"right-down", 0x08},
+    {"vertical-reset", 0x09},
+    {"horizontal-reset", 0x0A},
+    {"centre-reset", 0x0B},
+    {"center-reset", 0x0B},
+    {"no-lock", 0x00},
 };
 
-std::optional<const CommandParameter *>
-findFieldByName(const CommandInfo &command, const std::string &name) {
+constexpr ValueAliasEntry kRelativeDirectionValues[] = {
+    {"left", 0x01},
+    {"up", 0x01},
+    {"right", 0x02},
+    {"down", 0x02},
+};
+
+constexpr ValueAliasEntry kModeValues[] = {
+    {"no-angle", 0x01},
+    {"direct", 0x01},
+    {"relative", 0x02},
+    {"absolute", 0x03},
+    {"timed", 0x10},
+    {"time", 0x10},
+    {"distance", 0x11},
+    {"centre", 0x20},
+    {"center", 0x20},
+    {"locate-absolute", 0x21},
+    {"locate-relative", 0x22},
+};
+
+// Named values a field accepts, chosen by its normalized name. When several
+// vocabularies apply, later ones win for names they share.
+struct ValueVocabulary {
+  bool (*appliesTo)(const std::string &field);
+  std::span<const ValueAliasEntry> values;
+};
+
+const ValueVocabulary kValueVocabularies[] = {
+    {[](const std::string &f) {
+       return f.find("switch") != std::string::npos ||
+              f.find("status") != std::string::npos;
+     },
+     kSwitchValues},
+    {[](const std::string &f) { return f == "movewheeldirection"; },
+     kWheelDirectionValues},
+    {[](const std::string &f) { return f == "whichhand"; }, kHandValues},
+    {[](const std::string &f) { return f == "movehanddirection"; },
+     kHandDirectionValues},
+    {[](const std::string &f) { return f == "moveheaddirection"; },
+     kHeadDirectionValues},
+    {[](const std::string &f) {
+       return f.find("relativedirection") != std::string::npos;
+     },
+     kRelativeDirectionValues},
+    {[](const std::string &f) { return f.find("mode") != std::string::npos; },
+     kModeValues},
+};
+
+bool isCommandModeField(const CommandParameter &field) {
+  return field.payloadOffset == 0 &&
+         (normalizeKey(field.fieldName) == "commandmode" ||
+          field.fieldRole == "command_mode");
+}
+
+int32_t findParameterByName(const CommandInfo &command,
+                            const std::string &name) {
   std::string normalized = normalizeKey(name);
-  for (const auto &field : command.parameters) {
+  for (std::size_t i = 0; i < command.parameters.size(); ++i) {
+    const auto &field = command.parameters[i];
     if (normalizeKey(field.fieldName) == normalized ||
         normalizeKey(field.valueExpr) == normalized)
-      return &field;
+      return static_cast<int32_t>(i);
   }
-  return std::nullopt;
+  return -1;
 }
 
-std::optional<uint8_t> lookupNamedByte(const CommandInfo &command,
-                                       const ArgumentBag &bag,
-                                       const BuildContext &context,
-                                       const std::string &name) {
-  if (auto value = context.get(name))
-    return static_cast<uint8_t>(*value & 0xFF);
+std::optional<uint8_t> tryParseByteLiteral(const std::string &text,
+                                           std::string &error) {
+  try {
+    return parseByteLiteral(text);
+  } catch (const std::exception &ex) {
+    error = ex.what();
+    return std::nullopt;
+  }
+}
 
-  std::vector<std::string> keys{name};
-  if (auto field = findFieldByName(command, name)) {
-    for (const auto &key : argumentKeysForField(**field))
-      addUnique(keys, key);
+class CatalogueCompiler {
+public:
+  CatalogueStorage compile(const std::vector<CommandInfo> &commands);
+
+private:
+  CatalogueStorage tables_;
+  const CommandInfo *command_ = nullptr;
+  uint32_t parameterBase_ = 0;
+  std::vector<std::string> contextNames_;
+  std::vector<std::string> argumentKeys_;
+  std::unordered_map<std::string, TextRef> interned_;
+  std::map<uint32_t, PlanRange> valueAliasSets_;
+
+  TextRef intern(const std::string &text);
+  void addCommand(const CommandInfo &command);
+  void indexAliases(const std::vector<CommandInfo> &commands);
+  void buildAliasHash();
+  PlanRange addValueAliases(const std::string &fieldName);
+  int32_t contextSlot(const std::string &name, bool create = false);
+  PlanRange addKeys(const std::vector<std::string> &keys);
+  PlanRange sortArgumentKeys(std::size_t firstKeySlot);
+  int32_t addName(const std::string &name);
+  int32_t addCondition(const std::string &condition);
+  PlanTerm compileTerm(const std::string &term);
+  FieldPlan compileField(std::size_t index);
+  CommandPlan compilePlan(const CommandInfo &command, uint32_t parameterBase);
+};
+
+TextRef CatalogueCompiler::intern(const std::string &text) {
+  auto found = interned_.find(text);
+  if (found != interned_.end())
+    return found->second;
+
+  TextRef ref{static_cast<uint32_t>(tables_.text.size()),
+              static_cast<uint32_t>(text.size())};
+  tables_.text.insert(tables_.text.end(), text.begin(), text.end());
+  interned_.emplace(text, ref);
+  return ref;
+}
+
+void CatalogueCompiler::addCommand(const CommandInfo &command) {
+  CommandRecord record;
+  record.commandId = command.commandId;
+  record.canonicalName = intern(command.canonicalName);
+  record.commandGroup = intern(command.commandGroup);
+  record.commandModeHex = intern(command.commandModeHex);
+  record.ackDefaultHex = intern(command.ackDefaultHex);
+  record.targetName = intern(command.targetName);
+  record.routeTagHex = intern(command.routeTagHex);
+  record.routeHandling = intern(command.routeHandling);
+  record.payloadTemplate = intern(command.payloadTemplate);
+  record.description = intern(command.description);
+
+  record.aliases = {static_cast<uint32_t>(tables_.aliasNames.size()),
+                    static_cast<uint32_t>(command.aliases.size())};
+  for (const auto &alias : command.aliases)
+    tables_.aliasNames.push_back(intern(alias));
+
+  record.parameters = {static_cast<uint32_t>(tables_.parameters.size()),
+                       static_cast<uint32_t>(command.parameters.size())};
+  for (const auto &parameter : command.parameters) {
+    ParameterRecord out;
+    out.ordinal = parameter.ordinal;
+    out.payloadOffset = parameter.payloadOffset;
+    out.fieldName = intern(parameter.fieldName);
+    out.fieldRole = intern(parameter.fieldRole);
+    out.valueExpr = intern(parameter.valueExpr);
+    out.valueHex = intern(parameter.valueHex);
+    out.conditionExpr = intern(parameter.conditionExpr);
+    out.description = intern(parameter.description);
+    out.omitIfMinusOne = parameter.omitIfMinusOne ? 1 : 0;
+    out.valueAliases = addValueAliases(parameter.fieldName);
+    tables_.parameters.push_back(out);
   }
 
-  auto raw = bag.find(keys);
-  if (!raw)
-    return std::nullopt;
+  tables_.commands.push_back(record);
+}
 
-  if (auto field = findFieldByName(command, name)) {
-    if (auto alias = valueAlias((**field).fieldName, *raw))
-      return *alias;
+void CatalogueCompiler::indexAliases(const std::vector<CommandInfo> &commands) {
+  std::map<std::string, std::vector<uint32_t>> owners;
+  for (std::size_t i = 0; i < commands.size(); ++i) {
+    std::set<std::string> normalizedForCommand;
+    for (const auto &alias : commands[i].aliases) {
+      std::string normalized = normalizeKey(alias);
+      if (normalizedForCommand.insert(normalized).second)
+        owners[normalized].push_back(static_cast<uint32_t>(i));
+    }
+  }
+
+  for (const auto &[alias, indexes] : owners) {
+    AliasRecord record;
+    record.key = intern(alias);
+    record.command = indexes.size() == 1 ? static_cast<int32_t>(indexes[0]) : -1;
+    record.candidates = {static_cast<uint32_t>(tables_.aliasCandidates.size()),
+                         static_cast<uint32_t>(indexes.size())};
+    tables_.aliasCandidates.insert(tables_.aliasCandidates.end(),
+                                   indexes.begin(), indexes.end());
+    tables_.aliases.push_back(record);
   }
 
-  return parseByteLiteral(*raw);
+  buildAliasHash();
 }
 
-bool evalCondition(const std::string &condition, const CommandInfo &command,
-                   const ArgumentBag &bag, const BuildContext &context) {
+// Hash-and-displace: buckets are placed largest first, each trying seeds until
+// all of its keys land in distinct free slots.
+void CatalogueCompiler::buildAliasHash() {
+  std::size_t count = tables_.aliases.size();
+  if (count == 0)
+    return;
+
+  std::vector<uint64_t> hashes;
+  for (const auto &alias : tables_.aliases)
+    hashes.push_back(hashNormalizedKey(
+        std::string_view(tables_.text.data() + alias.key.offset,
+                         alias.key.length)));
+
+  std::size_t bucketCount = std::bit_ceil(std::max<std::size_t>(count / 2, 1));
+  std::vector<std::vector<uint32_t>> buckets(bucketCount);
+  for (uint32_t i = 0; i < count; ++i)
+    buckets[aliasBucket(hashes[i], bucketCount)].push_back(i);
+  std::vector<uint32_t> order(bucketCount);
+  for (uint32_t i = 0; i < bucketCount; ++i)
+    order[i] = i;
+  std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+    return buckets[a].size() > buckets[b].size();
+  });
+
+  constexpr uint32_t kMaxSeed = 1u << 20;
+  for (std::size_t slotCount = std::bit_ceil(count);; slotCount *= 2) {
+    std::vector<uint32_t> seeds(bucketCount, 0);
+    std::vector<uint32_t> slots(slotCount, kEmptyAliasSlot);
+    bool placedAll = true;
+
+    for (uint32_t bucket : order) {
+      if (buckets[bucket].empty())
+        break;
+      bool placed = false;
+      for (uint32_t seed = 0; seed < kMaxSeed && !placed; ++seed) {
+        std::vector<uint32_t> taken;
+        for (uint32_t alias : buckets[bucket]) {
+          uint32_t slot = seededSlotHash(hashes[alias], seed) & (slotCount - 1);
+          if (slots[slot] != kEmptyAliasSlot ||
+              std::find(taken.begin(), taken.end(), slot) != taken.end())
+            break;
+          taken.push_back(slot);
+        }
+        if (taken.size() != buckets[bucket].size())
+          continue;
+        for (std::size_t i = 0; i < taken.size(); ++i)
+          slots[taken[i]] = buckets[bucket][i];
+        seeds[bucket] = seed;
+        placed = true;
+      }
+      if (!placed) {
+        placedAll = false;
+        break;
+      }
+    }
+
+    if (placedAll) {
+      tables_.aliasSeeds = std::move(seeds);
+      tables_.aliasSlots = std::move(slots);
+      return;
+    }
+  }
+}
+
+// Fields that accept the same vocabularies share one sorted alias range.
+PlanRange CatalogueCompiler::addValueAliases(const std::string &fieldName) {
+  std::string field = normalizeKey(fieldName);
+  uint32_t vocabularies = 0;
+  for (std::size_t i = 0; i < std::size(kValueVocabularies); ++i) {
+    if (kValueVocabularies[i].appliesTo(field))
+      vocabularies |= 1u << i;
+  }
+  if (vocabularies == 0)
+    return {};
+
+  auto found = valueAliasSets_.find(vocabularies);
+  if (found != valueAliasSets_.end())
+    return found->second;
+
+  std::map<std::string, uint8_t> merged;
+  for (std::size_t i = 0; i < std::size(kValueVocabularies); ++i) {
+    if (vocabularies & (1u << i)) {
+      for (const auto &entry : kValueVocabularies[i].values)
+        merged[normalizeKey(entry.name)] = entry.value;
+    }
+  }
+
+  PlanRange range{static_cast<uint32_t>(tables_.valueAliases.size()),
+                  static_cast<uint32_t>(merged.size())};
+  for (const auto &[name, value] : merged)
+    tables_.valueAliases.push_back({intern(name), value});
+  valueAliasSets_.emplace(vocabularies, range);
+  return range;
+}
+
+int32_t CatalogueCompiler::contextSlot(const std::string &name, bool create) {
+  if (name.empty())
+    return -1;
+  std::string normalized = normalizeKey(name);
+  auto found =
+      std::find(contextNames_.begin(), contextNames_.end(), normalized);
+  if (found != contextNames_.end())
+    return static_cast<int32_t>(found - contextNames_.begin());
+  if (!create)
+    return -1;
+  contextNames_.push_back(std::move(normalized));
+  return static_cast<int32_t>(contextNames_.size() - 1);
+}
+
+PlanRange CatalogueCompiler::addKeys(const std::vector<std::string> &keys) {
+  std::vector<std::string> normalized;
+  for (const auto &key : keys) {
+    std::string n = normalizeKey(key);
+    if (std::find(normalized.begin(), normalized.end(), n) ==
+        normalized.end())
+      normalized.push_back(std::move(n));
+  }
+
+  PlanRange range{static_cast<uint32_t>(tables_.keySlots.size()),
+                  static_cast<uint32_t>(normalized.size())};
+  for (auto &key : normalized) {
+    auto found = std::find(argumentKeys_.begin(), argumentKeys_.end(), key);
+    if (found == argumentKeys_.end())
+      found = argumentKeys_.insert(argumentKeys_.end(), std::move(key));
+    tables_.keySlots.push_back(
+        static_cast<uint32_t>(found - argumentKeys_.begin()));
+  }
+  return range;
+}
+
+// Orders the command's argument keys so binding can binary-search them, and
+// renumbers the key slots the command's plan refers to.
+PlanRange CatalogueCompiler::sortArgumentKeys(std::size_t firstKeySlot) {
+  std::vector<uint32_t> order(argumentKeys_.size());
+  for (uint32_t i = 0; i < order.size(); ++i)
+    order[i] = i;
+  std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+    return argumentKeys_[a] < argumentKeys_[b];
+  });
+
+  std::vector<uint32_t> slotOf(order.size());
+  PlanRange range{static_cast<uint32_t>(tables_.argumentKeys.size()),
+                  static_cast<uint32_t>(order.size())};
+  for (uint32_t i = 0; i < order.size(); ++i) {
+    slotOf[order[i]] = i;
+    tables_.argumentKeys.push_back(intern(argumentKeys_[order[i]]));
+  }
+  for (std::size_t i = firstKeySlot; i < tables_.keySlots.size(); ++i)
+    tables_.keySlots[i] = slotOf[tables_.keySlots[i]];
+  return range;
+}
+
+int32_t CatalogueCompiler::addName(const std::string &name) {
+  PlanName planName;
+  planName.text = intern(name);
+  planName.contextSlot = contextSlot(name);
+
+  std::vector<std::string> keys{name};
+  int32_t parameter = findParameterByName(*command_, name);
+  if (parameter >= 0) {
+    planName.aliasParameter =
+        static_cast<int32_t>(parameterBase_) + parameter;
+    for (const auto &key :
+         argumentKeysForField(command_->parameters[parameter]))
+      addUnique(keys, key);
+  }
+  planName.keys = addKeys(keys);
+
+  tables_.names.push_back(planName);
+  return static_cast<int32_t>(tables_.names.size() - 1);
+}
+
+int32_t CatalogueCompiler::addCondition(const std::string &condition) {
+  PlanCondition compiled;
   std::string expr = trim(condition);
+  std::string error;
+
+  auto finish = [&]() {
+    if (!error.empty()) {
+      compiled.op = ConditionOp::Invalid;
+      compiled.message = intern(error);
+    }
+    tables_.conditions.push_back(compiled);
+    return static_cast<int32_t>(tables_.conditions.size() - 1);
+  };
+
   if (expr.empty())
-    return true;
+    return finish();
 
   std::size_t inPos = expr.find(" in ");
   if (inPos != std::string::npos) {
     std::string name = trim(expr.substr(0, inPos));
     std::size_t open = expr.find('(', inPos);
     std::size_t close = expr.find(')', open);
-    if (open == std::string::npos || close == std::string::npos)
-      throw std::runtime_error("unsupported condition: " + condition);
-
-    auto value = lookupNamedByte(command, bag, context, name);
-    if (!value)
-      throw std::runtime_error("missing argument needed by condition: " + name);
+    if (open == std::string::npos || close == std::string::npos) {
+      error = "unsupported condition: " + condition;
+      return finish();
+    }
 
+    compiled.op = ConditionOp::In;
+    compiled.name = addName(name);
+    compiled.values.begin = static_cast<uint32_t>(tables_.bytes.size());
     std::stringstream items(expr.substr(open + 1, close - open - 1));
     std::string item;
-    while (std::getline(items, item, ',')) {
-      if (*value == parseByteLiteral(item))
-        return true;
+    while (error.empty() && std::getline(items, item, ',')) {
+      if (auto value = tryParseByteLiteral(item, error)) {
+        tables_.bytes.push_back(*value);
+        compiled.values.count++;
+      }
     }
-    return false;
+    return finish();
   }
 
   for (const std::string op : {"!=", "=="}) {
@@ -492,111 +877,732 @@ bool evalCondition(const std::string &condition, const CommandInfo &command,
     if (opPos == std::string::npos)
       continue;
 
-    std::string name = trim(expr.substr(0, opPos));
-    std::string rhs = trim(expr.substr(opPos + op.size()));
-    auto value = lookupNamedByte(command, bag, context, name);
-    if (!value)
-      throw std::runtime_error("missing argument needed by condition: " + name);
-    bool equal = (*value == parseByteLiteral(rhs));
-    return op == "==" ? equal : !equal;
+    compiled.op = op == "==" ? ConditionOp::Equal : ConditionOp::NotEqual;
+    compiled.name = addName(trim(expr.substr(0, opPos)));
+    compiled.values = {static_cast<uint32_t>(tables_.bytes.size()), 1};
+    if (auto value =
+            tryParseByteLiteral(trim(expr.substr(opPos + op.size())), error))
+      tables_.bytes.push_back(*value);
+    return finish();
   }
 
-  throw std::runtime_error("unsupported condition: " + condition);
+  error = "unsupported condition: " + condition;
+  return finish();
 }
 
-uint8_t evalTermByte(const std::string &term, const CommandInfo &command,
-                     const ArgumentBag &bag, const BuildContext &context,
-                     const CommandParameter &field) {
+PlanTerm CatalogueCompiler::compileTerm(const std::string &term) {
+  PlanTerm compiled;
   std::string value = trim(term);
-  if (value.rfind("0x", 0) == 0 || (!value.empty() && std::isdigit(value[0])))
-    return parseByteLiteral(value);
-
-  auto named = lookupNamedByte(command, bag, context, value);
-  if (named)
-    return *named;
-
-  if (auto raw = bag.find(argumentKeysForField(field))) {
-    if (auto alias = valueAlias(field.fieldName, *raw))
-      return *alias;
-    return parseByteLiteral(*raw);
+  compiled.text = intern(value);
+
+  if (value.rfind("0x", 0) == 0 ||
+      (!value.empty() && std::isdigit(static_cast<unsigned char>(value[0])))) {
+    std::string error;
+    if (auto literal = tryParseByteLiteral(value, error)) {
+      compiled.kind = TermKind::Literal;
+      compiled.value = *literal;
+    } else {
+      compiled.kind = TermKind::Invalid;
+      compiled.text = intern(error);
+    }
+    return compiled;
   }
 
-  throw std::runtime_error("missing argument: " + value);
+  compiled.kind = TermKind::Name;
+  compiled.name = addName(value);
+  return compiled;
 }
 
-std::optional<std::vector<uint8_t>>
-resolveFieldBytes(const CommandInfo &command, const CommandParameter &field,
-                  const ArgumentBag &bag, const BuildContext &context,
-                  bool required) {
-  if (!field.valueHex.empty())
-    return std::vector<uint8_t>{parseByteLiteral(field.valueHex)};
+FieldPlan CatalogueCompiler::compileField(std::size_t index) {
+  const CommandParameter &field = command_->parameters[index];
+
+  FieldPlan plan;
+  plan.parameter = static_cast<int32_t>(parameterBase_ + index);
+  plan.name = intern(field.fieldName);
+  plan.rememberSlots[0] = contextSlot(field.fieldName);
+  if (isSimpleIdentifier(field.valueExpr)) {
+    int32_t slot = contextSlot(field.valueExpr);
+    if (slot != plan.rememberSlots[0])
+      plan.rememberSlots[1] = slot;
+  }
+  if (!field.conditionExpr.empty())
+    plan.condition = addCondition(field.conditionExpr);
+
+  if (!field.valueHex.empty()) {
+    std::string error;
+    if (auto value = tryParseByteLiteral(field.valueHex, error)) {
+      plan.op = FieldOp::Constant;
+      plan.constant = *value;
+    } else {
+      plan.op = FieldOp::Invalid;
+      plan.message = intern(error);
+    }
+    return plan;
+  }
 
   std::string expr = trim(field.valueExpr);
-  if (expr.empty() || expr == "constant")
-    return std::nullopt;
+  if (expr.empty() || expr == "constant") {
+    plan.op = FieldOp::Skip;
+    return plan;
+  }
 
   if (endsWith(expr, "[]")) {
     std::string base = expr.substr(0, expr.size() - 2);
     std::vector<std::string> keys = argumentKeysForField(field);
     addUnique(keys, base);
     addUnique(keys, expr);
-    auto raw = bag.find(keys);
-    if (!raw) {
-      if (required)
-        throw std::runtime_error("missing array argument: " + base);
-      return std::nullopt;
-    }
-    return parseByteList(*raw);
+    plan.op = FieldOp::Array;
+    plan.keys = addKeys(keys);
+    plan.message = intern(base);
+    return plan;
   }
 
+  plan.keys = addKeys(argumentKeysForField(field));
+
   std::size_t question = expr.find('?');
-  std::size_t colon = expr.find(':', question == std::string::npos ? 0 : question);
+  std::size_t colon =
+      expr.find(':', question == std::string::npos ? 0 : question);
   if (question != std::string::npos && colon != std::string::npos) {
-    std::string condition = trim(expr.substr(0, question));
-    std::string thenTerm = trim(expr.substr(question + 1, colon - question - 1));
-    std::string elseTerm = trim(expr.substr(colon + 1));
-    bool conditionValue = evalCondition(condition, command, bag, context);
-    return std::vector<uint8_t>{
-        evalTermByte(conditionValue ? thenTerm : elseTerm, command, bag,
-                     context, field)};
+    plan.op = FieldOp::Select;
+    plan.select = addCondition(trim(expr.substr(0, question)));
+    plan.terms[0] =
+        compileTerm(expr.substr(question + 1, colon - question - 1));
+    plan.terms[1] = compileTerm(expr.substr(colon + 1));
+    return plan;
   }
 
   bool wantsLsb = field.fieldName.find("LSB") != std::string::npos;
   bool wantsMsb = field.fieldName.find("MSB") != std::string::npos;
   if (wantsLsb || wantsMsb) {
-    if (auto wideRaw = bag.find(baseKeysForHalfField(field.fieldName))) {
-      uint16_t value = parseU16Literal(*wideRaw);
-      return std::vector<uint8_t>{static_cast<uint8_t>(
-          wantsLsb ? (value & 0xFF) : ((value >> 8) & 0xFF))};
+    plan.op = FieldOp::HalfWord;
+    plan.lowByte = wantsLsb;
+    plan.halfKeys = addKeys(baseKeysForHalfField(field.fieldName));
+    return plan;
+  }
+
+  plan.op = FieldOp::Argument;
+  return plan;
+}
+
+CommandPlan CatalogueCompiler::compilePlan(const CommandInfo &command,
+                                           uint32_t parameterBase) {
+  command_ = &command;
+  parameterBase_ = parameterBase;
+  contextNames_.clear();
+  argumentKeys_.clear();
+  std::size_t firstKeySlot = tables_.keySlots.size();
+
+  CommandPlan plan;
+  plan.commandModeSlot = contextSlot("commandMode", true);
+  for (const auto &field : command.parameters) {
+    if (isCommandModeField(field))
+      continue;
+    contextSlot(field.fieldName, true);
+    if (isSimpleIdentifier(field.valueExpr))
+      contextSlot(field.valueExpr, true);
+  }
+
+  std::string error;
+  auto parse = [&](const std::string &text, uint8_t &out) {
+    if (!error.empty())
+      return;
+    if (auto value = tryParseByteLiteral(text, error))
+      out = *value;
+  };
+  parse(command.commandModeHex, plan.commandMode);
+  if (!command.ackDefaultHex.empty())
+    parse(command.ackDefaultHex, plan.ackFlag);
+  if (!command.routeTagHex.empty()) {
+    plan.hasRouteTag = true;
+    parse(command.routeTagHex, plan.routeTag);
+  }
+
+  plan.fields.begin = static_cast<uint32_t>(tables_.fields.size());
+  for (std::size_t i = 0; i < command.parameters.size(); ++i) {
+    if (isCommandModeField(command.parameters[i]))
+      continue;
+    tables_.fields.push_back(compileField(i));
+    plan.fields.count++;
+  }
+
+  plan.contextSlots = static_cast<uint32_t>(contextNames_.size());
+  plan.argumentKeys = sortArgumentKeys(firstKeySlot);
+  if (error.empty() && (plan.fields.count > kMaxPlanFields ||
+                        plan.contextSlots > kMaxPlanContextSlots ||
+                        plan.argumentKeys.count > kMaxArgumentSlots))
+    error = "command has too many payload fields: " + command.canonicalName;
+  if (!error.empty())
+    plan.message = intern(error);
+
+  command_ = nullptr;
+  return plan;
+}
+
+CatalogueStorage
+CatalogueCompiler::compile(const std::vector<CommandInfo> &commands) {
+  tables_ = {};
+  interned_.clear();
+  valueAliasSets_.clear();
+
+  for (const auto &command : commands)
+    addCommand(command);
+  indexAliases(commands);
+
+  tables_.plans.reserve(commands.size());
+  for (std::size_t i = 0; i < commands.size(); ++i)
+    tables_.plans.push_back(
+        compilePlan(commands[i], tables_.commands[i].parameters.begin));
+
+  return std::move(tables_);
+}
+
+std::vector<CommandInfo> commandsFromTables(const CatalogueTables &tables) {
+  auto text = [&](TextRef ref) { return std::string(tables.textOf(ref)); };
+
+  std::vector<CommandInfo> commands;
+  commands.reserve(tables.commands.size());
+  for (const auto &record : tables.commands) {
+    CommandInfo info;
+    info.commandId = record.commandId;
+    info.canonicalName = text(record.canonicalName);
+    info.commandGroup = text(record.commandGroup);
+    info.commandModeHex = text(record.commandModeHex);
+    info.ackDefaultHex = text(record.ackDefaultHex);
+    info.targetName = text(record.targetName);
+    info.routeTagHex = text(record.routeTagHex);
+    info.routeHandling = text(record.routeHandling);
+    info.payloadTemplate = text(record.payloadTemplate);
+    info.description = text(record.description);
+    for (uint32_t i = 0; i < record.aliases.count; ++i)
+      info.aliases.push_back(
+          text(tables.aliasNames[record.aliases.begin + i]));
+    for (uint32_t i = 0; i < record.parameters.count; ++i) {
+      const ParameterRecord &in = tables.parameters[record.parameters.begin + i];
+      CommandParameter parameter;
+      parameter.ordinal = in.ordinal;
+      parameter.payloadOffset = in.payloadOffset;
+      parameter.fieldName = text(in.fieldName);
+      parameter.fieldRole = text(in.fieldRole);
+      parameter.valueExpr = text(in.valueExpr);
+      parameter.valueHex = text(in.valueHex);
+      parameter.conditionExpr = text(in.conditionExpr);
+      parameter.omitIfMinusOne = in.omitIfMinusOne != 0;
+      parameter.description = text(in.description);
+      info.parameters.push_back(std::move(parameter));
     }
+    commands.push_back(std::move(info));
   }
+  return commands;
+}
 
-  auto raw = bag.find(argumentKeysForField(field));
-  if (!raw) {
-    if (required)
-      throw std::runtime_error("missing argument: " + field.fieldName);
-    return std::nullopt;
+// Arguments supplied as text, from the command line or a CommandArgs map.
+class TextArguments {
+public:
+  static constexpr bool kBorrowsArrays = false;
+
+  explicit TextArguments(ArgumentSlots slots) : slots_(slots) {}
+
+  bool has(uint32_t slot) const {
+    return slot < slots_.size() && slots_[slot].has_value();
   }
 
-  if (auto alias = valueAlias(field.fieldName, *raw))
-    return std::vector<uint8_t>{*alias};
+  BuildErrc byte(const CatalogueTables &tables, uint32_t slot,
+                 int32_t parameter, uint8_t &out) const {
+    std::string_view raw = *slots_[slot];
+    if (parameter >= 0) {
+      if (auto alias = findValueAlias(
+              tables, tables.parameters[parameter].valueAliases, raw)) {
+        out = *alias;
+        return BuildErrc::Ok;
+      }
+    }
+    uint64_t value = 0;
+    BuildErrc code = parseUnsignedValue(raw, 0xFF, value);
+    out = static_cast<uint8_t>(value);
+    return code;
+  }
 
-  return std::vector<uint8_t>{parseByteLiteral(*raw)};
+  BuildErrc halfWord(uint32_t slot, uint16_t &out) const {
+    uint64_t value = 0;
+    BuildErrc code = parseUnsignedValue(*slots_[slot], 0xFFFF, value);
+    out = static_cast<uint16_t>(value);
+    return code;
+  }
+
+  BuildErrc appendBytes(uint32_t slot, std::vector<uint8_t> &out,
+                        std::string_view &bad) const {
+    return appendByteList(*slots_[slot], out, bad);
+  }
+
+  // The argument as the caller gave it, for error messages.
+  std::string spelling(uint32_t slot) const {
+    return std::string(*slots_[slot]);
+  }
+
+private:
+  ArgumentSlots slots_;
+};
+
+using BoundArguments =
+    std::array<std::optional<std::string_view>, kMaxArgumentSlots>;
+
+// Later arguments win when several normalize to the same key.
+ArgumentSlots bindArguments(const CatalogueTables &tables,
+                            const CommandPlan &plan, const CommandArgs &args,
+                            BoundArguments &slots) {
+  for (const auto &[key, value] : args) {
+    int32_t slot = findArgumentSlot(tables, plan.argumentKeys, key);
+    if (slot >= 0)
+      slots[slot] = value;
+  }
+  return ArgumentSlots(slots.data(), plan.argumentKeys.count);
+}
+
+// Arguments supplied as numbers through a PreparedCommand.
+class NumericArguments {
+public:
+  static constexpr bool kBorrowsArrays = false;
+
+  NumericArguments(const int64_t *values, uint64_t present)
+      : values_(values), present_(present) {}
+
+  bool has(uint32_t slot) const { return (present_ >> slot) & 1; }
+
+  BuildErrc byte(const CatalogueTables &, uint32_t slot, int32_t,
+                 uint8_t &out) const {
+    out = static_cast<uint8_t>(values_[slot]);
+    return checked(slot, 0xFF);
+  }
+
+  BuildErrc halfWord(uint32_t slot, uint16_t &out) const {
+    out = static_cast<uint16_t>(values_[slot]);
+    return checked(slot, 0xFFFF);
+  }
+
+  BuildErrc appendBytes(uint32_t slot, std::vector<uint8_t> &out,
+                        std::string_view &) const {
+    BuildErrc code = checked(slot, 0xFF);
+    if (code == BuildErrc::Ok)
+      out.push_back(static_cast<uint8_t>(values_[slot]));
+    return code;
+  }
+
+  std::string spelling(uint32_t slot) const {
+    return std::to_string(values_[slot]);
+  }
+
+private:
+  const int64_t *values_;
+  uint64_t present_;
+
+  BuildErrc checked(uint32_t slot, int64_t maxValue) const {
+    int64_t value = values_[slot];
+    return value < 0 || value > maxValue ? BuildErrc::OutOfRange
+                                         : BuildErrc::Ok;
+  }
+};
+
+// Text arguments whose array field is left out of the payload, to be supplied
+// as a borrowed view (buildScatterCommand).
+class BorrowedArrayArguments : public TextArguments {
+public:
+  static constexpr bool kBorrowsArrays = true;
+
+  using TextArguments::TextArguments;
+};
+
+// Buffers for the non-throwing builds, kept per thread so that a build, and in
+// particular a failed one, reuses the capacity of earlier builds.
+struct BuildScratch {
+  CommandPayload payload;
+  std::vector<uint8_t> arrayBytes;
+};
+
+BuildScratch &buildScratch() {
+  thread_local BuildScratch scratch;
+  return scratch;
+}
+
+// Runs a command's build plan. tryRun reports the first failure in error()
+// and stops; run throws it with the message buildCommand has always given.
+template <typename Arguments> class PlanExecutor {
+public:
+  // plan is an entry of tables.plans.
+  PlanExecutor(const CatalogueTables &tables, const CommandPlan &plan,
+               const Arguments &arguments, FrameTrace *trace = nullptr)
+      : tables_(tables), plan_(plan), arguments_(arguments), trace_(trace),
+        parameterBase_(
+            tables.commands[&plan - tables.plans.data()].parameters.begin) {
+    contextSource_.fill(-1);
+  }
+
+  CommandPayload run() {
+    CommandPayload payload;
+    run(payload);
+    return payload;
+  }
+  void run(CommandPayload &payload) {
+    if (!tryRun(payload))
+      throw std::runtime_error(message());
+  }
+  bool tryRun(CommandPayload &payload);
+
+  // Collect array arguments in bytes instead of a buffer of the executor's
+  // own.
+  void keepArraysIn(std::vector<uint8_t> &bytes) { arrayBytes_ = &bytes; }
+
+  const BuildError &error() const { return error_; }
+  std::string message() const;
+
+  // Where the borrowed array belongs in orderedBytes, if the plan has one.
+  std::optional<std::size_t> borrowedAt() const { return borrowedAt_; }
+
+private:
+  enum class State : uint8_t {
+    Unresolved,
+    Skipped,
+    Missing,
+    Byte,
+    Bytes,
+    Borrowed
+  };
+
+  // source is the argument slot a byte was copied from (shifted right by
+  // shift bits), or -1 when it was computed.
+  struct FieldValue {
+    State state = State::Unresolved;
+    uint8_t byte = 0;
+    uint8_t shift = 0;
+    int32_t source = -1;
+    PlanRange bytes;
+  };
+
+  const CatalogueTables &tables_;
+  const CommandPlan &plan_;
+  const Arguments &arguments_;
+  FrameTrace *trace_;
+  uint32_t parameterBase_;
+  std::array<uint8_t, kMaxPlanContextSlots> context_{};
+  std::array<int32_t, kMaxPlanContextSlots> contextSource_;
+  uint64_t contextPresent_ = 0;
+  std::array<FieldValue, kMaxPlanFields> values_{};
+  std::vector<uint8_t> ownArrayBytes_;
+  std::vector<uint8_t> *arrayBytes_ = &ownArrayBytes_;
+  std::optional<std::size_t> borrowedAt_;
+  const FieldPlan *field_ = nullptr;
+  BuildError error_;
+  // The rejected element of an array argument, for message().
+  std::string_view badElement_;
+
+  // Records the first failure against the field being built; always false so
+  // that callers can return it.
+  bool fail(BuildErrc code, TextRef detail, int32_t argument = -1,
+            uint32_t limit = 0) {
+    if (error_.code != BuildErrc::Ok)
+      return false;
+    error_.code = code;
+    error_.detail = detail;
+    error_.argument = argument;
+    error_.limit = limit;
+    if (field_ && field_->parameter >= 0)
+      error_.field = field_->parameter - static_cast<int32_t>(parameterBase_);
+    return false;
+  }
+  bool failed() const { return error_.code != BuildErrc::Ok; }
+
+  void setContext(int32_t slot, uint8_t value, int32_t source = -1) {
+    if (slot < 0)
+      return;
+    context_[slot] = value;
+    contextSource_[slot] = source;
+    contextPresent_ |= uint64_t{1} << slot;
+  }
+
+  // Argument reads reported to the trace: steering reads decide which bytes
+  // the frame has, value reads only supply them.
+  void steeredBy(int32_t slot) const {
+    if (trace_ && slot >= 0)
+      trace_->structural |= uint64_t{1} << slot;
+  }
+
+  bool readByte(uint32_t slot, int32_t parameter, uint8_t &out) {
+    if (trace_)
+      trace_->limits[slot] = std::min<int64_t>(trace_->limits[slot], 0xFF);
+    BuildErrc code = arguments_.byte(tables_, slot, parameter, out);
+    return code == BuildErrc::Ok ||
+           fail(code, {}, static_cast<int32_t>(slot), 0xFF);
+  }
+
+  bool readHalfWord(uint32_t slot, uint16_t &out) {
+    if (trace_)
+      trace_->limits[slot] = std::min<int64_t>(trace_->limits[slot], 0xFFFF);
+    BuildErrc code = arguments_.halfWord(slot, out);
+    return code == BuildErrc::Ok ||
+           fail(code, {}, static_cast<int32_t>(slot), 0xFFFF);
+  }
+
+  // Slot of the first of the keys the caller supplied, in the plan's
+  // preference order, or -1.
+  int32_t find(PlanRange keys) const {
+    for (uint32_t i = 0; i < keys.count; ++i) {
+      uint32_t slot = tables_.keySlots[keys.begin + i];
+      if (arguments_.has(slot))
+        return static_cast<int32_t>(slot);
+    }
+    return -1;
+  }
+
+  void remember(const FieldPlan &field, const FieldValue &value);
+  std::optional<uint8_t> lookupNamedByte(int32_t name);
+  bool evalCondition(int32_t condition, bool &holds);
+  bool evalTerm(const PlanTerm &term, const FieldPlan &field, uint8_t &out);
+  bool resolve(const FieldPlan &field, bool required, FieldValue &value);
+};
+
+template <typename Arguments>
+std::string PlanExecutor<Arguments>::message() const {
+  std::string detail(tables_.textOf(error_.detail));
+  switch (error_.code) {
+  case BuildErrc::MissingArgument:
+    return "missing argument: " + detail;
+  case BuildErrc::MissingArrayArgument:
+    return "missing array argument: " + detail;
+  case BuildErrc::MissingConditionArgument:
+    return "missing argument needed by condition: " + detail;
+  case BuildErrc::EmptyValue:
+  case BuildErrc::InvalidValue:
+  case BuildErrc::TrailingCharacters:
+  case BuildErrc::OutOfRange:
+    return valueErrorMessage(error_.code,
+                             error_.limit == 0xFFFF ? "u16" : "byte",
+                             badElement_.empty()
+                                 ? arguments_.spelling(error_.argument)
+                                 : std::string(badElement_));
+  case BuildErrc::EmptyArray:
+    return "array argument must contain at least one byte";
+  case BuildErrc::MultipleArrays:
+    return "command has more than one array field";
+  default:
+    return detail;
+  }
 }
 
-void rememberSingleByte(BuildContext &context, const CommandParameter &field,
-                        const std::vector<uint8_t> &bytes) {
-  if (bytes.size() != 1)
+template <typename Arguments>
+void PlanExecutor<Arguments>::remember(const FieldPlan &field,
+                                       const FieldValue &value) {
+  uint8_t byte = 0;
+  if (value.state == State::Byte)
+    byte = value.byte;
+  else if (value.state == State::Bytes && value.bytes.count == 1)
+    byte = (*arrayBytes_)[value.bytes.begin];
+  else
     return;
-  context.set(field.fieldName, bytes.front());
-  if (isSimpleIdentifier(field.valueExpr))
-    context.set(field.valueExpr, bytes.front());
+  setContext(field.rememberSlots[0], byte, value.source);
+  setContext(field.rememberSlots[1], byte, value.source);
 }
 
-bool isCommandModeField(const CommandParameter &field) {
-  return field.payloadOffset == 0 &&
-         (normalizeKey(field.fieldName) == "commandmode" ||
-          field.fieldRole == "command_mode");
+// An empty result with no error recorded means the name was not given.
+template <typename Arguments>
+std::optional<uint8_t> PlanExecutor<Arguments>::lookupNamedByte(int32_t index) {
+  const PlanName &name = tables_.names[index];
+  if (name.contextSlot >= 0 &&
+      (contextPresent_ & (uint64_t{1} << name.contextSlot))) {
+    steeredBy(contextSource_[name.contextSlot]);
+    return context_[name.contextSlot];
+  }
+
+  int32_t slot = find(name.keys);
+  if (slot < 0)
+    return std::nullopt;
+  steeredBy(slot);
+  uint8_t value = 0;
+  if (!readByte(slot, name.aliasParameter, value))
+    return std::nullopt;
+  return value;
+}
+
+template <typename Arguments>
+bool PlanExecutor<Arguments>::evalCondition(int32_t index, bool &holds) {
+  const PlanCondition &condition = tables_.conditions[index];
+  if (condition.op == ConditionOp::Always) {
+    holds = true;
+    return true;
+  }
+  if (condition.op == ConditionOp::Invalid)
+    return fail(BuildErrc::Unsupported, condition.message);
+
+  auto value = lookupNamedByte(condition.name);
+  if (!value)
+    return fail(BuildErrc::MissingConditionArgument,
+                tables_.names[condition.name].text);
+
+  const uint8_t *begin = tables_.bytes.data() + condition.values.begin;
+  const uint8_t *end = begin + condition.values.count;
+  bool found = std::find(begin, end, *value) != end;
+  holds = condition.op == ConditionOp::NotEqual ? !found : found;
+  return true;
+}
+
+template <typename Arguments>
+bool PlanExecutor<Arguments>::evalTerm(const PlanTerm &term,
+                                       const FieldPlan &field, uint8_t &out) {
+  if (term.kind == TermKind::Literal) {
+    out = term.value;
+    return true;
+  }
+  if (term.kind == TermKind::Invalid)
+    return fail(BuildErrc::Unsupported, term.text);
+
+  if (auto named = lookupNamedByte(term.name)) {
+    out = *named;
+    return true;
+  }
+  if (failed())
+    return false;
+  if (int32_t slot = find(field.keys); slot >= 0) {
+    steeredBy(slot);
+    return readByte(slot, field.parameter, out);
+  }
+  return fail(BuildErrc::MissingArgument, term.text);
+}
+
+template <typename Arguments>
+bool PlanExecutor<Arguments>::resolve(const FieldPlan &field, bool required,
+                                      FieldValue &value) {
+  field_ = &field;
+  value = FieldValue{};
+  switch (field.op) {
+  case FieldOp::Skip:
+    value.state = State::Skipped;
+    return true;
+  case FieldOp::Constant:
+    value.state = State::Byte;
+    value.byte = field.constant;
+    return true;
+  case FieldOp::Invalid:
+    return fail(BuildErrc::Unsupported, field.message);
+  case FieldOp::Array: {
+    if constexpr (Arguments::kBorrowsArrays) {
+      value.state = State::Borrowed;
+      return true;
+    }
+    int32_t slot = find(field.keys);
+    if (slot < 0) {
+      if (required)
+        return fail(BuildErrc::MissingArrayArgument, field.message);
+      value.state = State::Missing;
+      return true;
+    }
+    uint32_t begin = static_cast<uint32_t>(arrayBytes_->size());
+    if (trace_)
+      trace_->limits[slot] = std::min<int64_t>(trace_->limits[slot], 0xFF);
+    if (BuildErrc code =
+            arguments_.appendBytes(slot, *arrayBytes_, badElement_);
+        code != BuildErrc::Ok)
+      return fail(code, {}, slot, 0xFF);
+    value.source = slot;
+    value.state = State::Bytes;
+    value.bytes = {begin, static_cast<uint32_t>(arrayBytes_->size() - begin)};
+    return true;
+  }
+  case FieldOp::Select: {
+    bool holds = false;
+    value.state = State::Byte;
+    return evalCondition(field.select, holds) &&
+           evalTerm(field.terms[holds ? 0 : 1], field, value.byte);
+  }
+  case FieldOp::HalfWord:
+    if (int32_t wideSlot = find(field.halfKeys); wideSlot >= 0) {
+      uint16_t wide = 0;
+      if (!readHalfWord(wideSlot, wide))
+        return false;
+      value.state = State::Byte;
+      value.source = wideSlot;
+      value.shift = field.lowByte ? 0 : 8;
+      value.byte = static_cast<uint8_t>(field.lowByte ? (wide & 0xFF)
+                                                      : ((wide >> 8) & 0xFF));
+      return true;
+    }
+    [[fallthrough]];
+  case FieldOp::Argument:
+    break;
+  }
+
+  int32_t slot = find(field.keys);
+  if (slot < 0) {
+    if (required)
+      return fail(BuildErrc::MissingArgument, field.name);
+    value.state = State::Missing;
+    return true;
+  }
+  value.state = State::Byte;
+  value.source = slot;
+  return readByte(slot, field.parameter, value.byte);
+}
+
+template <typename Arguments>
+bool PlanExecutor<Arguments>::tryRun(CommandPayload &payload) {
+  if (plan_.message.length != 0)
+    return fail(BuildErrc::Unsupported, plan_.message);
+
+  payload.orderedBytes.clear();
+  arrayBytes_->clear();
+  borrowedAt_.reset();
+  payload.commandMode = plan_.commandMode;
+  setContext(plan_.commandModeSlot, plan_.commandMode);
+  if (trace_)
+    trace_->commandMode = plan_.commandMode;
+
+  const FieldPlan *fields = tables_.fields.data() + plan_.fields.begin;
+  for (uint32_t i = 0; i < plan_.fields.count; ++i) {
+    if (fields[i].condition >= 0)
+      continue;
+    if (!resolve(fields[i], false, values_[i]))
+      return false;
+    remember(fields[i], values_[i]);
+  }
+
+  for (uint32_t i = 0; i < plan_.fields.count; ++i) {
+    const FieldPlan &field = fields[i];
+    FieldValue value = values_[i];
+    if (field.condition >= 0) {
+      field_ = &field;
+      bool holds = false;
+      if (!evalCondition(field.condition, holds))
+        return false;
+      if (!holds)
+        continue;
+      if (!resolve(field, true, value))
+        return false;
+    } else if (field.op == FieldOp::Select || value.state == State::Missing) {
+      if (!resolve(field, true, value))
+        return false;
+    }
+
+    if (value.state == State::Byte) {
+      payload.orderedBytes.push_back(static_cast<int8_t>(value.byte));
+      if (trace_)
+        trace_->payload.push_back({value.source, value.shift, value.byte});
+    } else if (value.state == State::Bytes) {
+      for (uint32_t b = 0; b < value.bytes.count; ++b) {
+        uint8_t byte = (*arrayBytes_)[value.bytes.begin + b];
+        payload.orderedBytes.push_back(static_cast<int8_t>(byte));
+        if (trace_)
+          trace_->payload.push_back(
+              {value.bytes.count == 1 ? value.source : -1, 0, byte});
+      }
+    } else if (value.state == State::Borrowed) {
+      field_ = &field;
+      if (borrowedAt_)
+        return fail(BuildErrc::MultipleArrays, {});
+      borrowedAt_ = payload.orderedBytes.size();
+      continue;
+    } else {
+      continue;
+    }
+    remember(field, value);
+  }
+  return true;
 }
 
 } // namespace
@@ -643,9 +1649,33 @@ CommandArgs parseCommandArgs(const std::vector<std::string> &tokens) {
   return args;
 }
 
-CommandDatabase::CommandDatabase(const std::string &dbPath) : dbPath_(dbPath) {
-  load();
-  indexAliases();
+struct CommandDatabase::CommandCache {
+  std::once_flag once;
+  std::vector<CommandInfo> commands;
+};
+
+CommandDatabase::CommandDatabase(const std::string &dbPath,
+                                 SnapshotPolicy snapshotPolicy)
+    : dbPath_(dbPath), commandCache_(std::make_shared<CommandCache>()) {
+  if (snapshotPolicy == SnapshotPolicy::UseIfCurrent)
+    snapshot_ = CatalogueSnapshot::open(snapshotPathFor(dbPath_), dbPath_);
+  if (snapshot_)
+    tables_ = snapshot_->tables();
+  else
+    load();
+}
+
+CommandDatabase::CommandDatabase(EmbeddedCatalogue)
+    : dbPath_("<embedded>"), commandCache_(std::make_shared<CommandCache>()) {
+  const CatalogueTables *embedded = embeddedCatalogueTables();
+  if (!embedded)
+    throw std::runtime_error(
+        "this build does not include an embedded command catalogue");
+  tables_ = *embedded;
+}
+
+bool CommandDatabase::hasEmbeddedCatalogue() {
+  return embeddedCatalogueTables() != nullptr;
 }
 
 std::string CommandDatabase::findDefaultDatabasePath(
@@ -679,159 +1709,448 @@ std::string CommandDatabase::findDefaultDatabasePath(
       "SANBOT_MCU_COMMAND_DB or pass --db");
 }
 
+std::string CommandDatabase::snapshotPathFor(const std::string &dbPath) {
+  return dbPath + ".snapshot";
+}
+
 void CommandDatabase::load() {
-  SQLiteHandle db(dbPath_);
-
-  Statement commands(
-      db.db,
-      "SELECT c.command_id, c.canonical_name, c.command_group, "
-      "c.command_mode_hex, c.ack_default_hex, c.payload_template, "
-      "c.description, t.name, COALESCE(t.route_tag_hex, ''), "
-      "c.route_handling "
-      "FROM commands c "
-      "JOIN usb_targets t ON t.target_id = c.target_id "
-      "ORDER BY c.canonical_name");
-
-  while (commands.step()) {
-    CommandInfo info;
-    info.commandId = sqlite3_column_int(commands.stmt, 0);
-    info.canonicalName = sqliteText(commands.stmt, 1);
-    info.commandGroup = sqliteText(commands.stmt, 2);
-    info.commandModeHex = sqliteText(commands.stmt, 3);
-    info.ackDefaultHex = sqliteText(commands.stmt, 4);
-    info.payloadTemplate = sqliteText(commands.stmt, 5);
-    info.description = sqliteText(commands.stmt, 6);
-    info.targetName = sqliteText(commands.stmt, 7);
-    info.routeTagHex = sqliteText(commands.stmt, 8);
-    info.routeHandling = sqliteText(commands.stmt, 9);
-    commands_.push_back(std::move(info));
-  }
-
-  for (auto &command : commands_) {
-    Statement fields(
-        db.db,
-        "SELECT ordinal, payload_offset, field_name, field_role, "
-        "COALESCE(value_expr, ''), COALESCE(value_hex, ''), "
-        "COALESCE(condition_expr, ''), omit_if_minus_one, "
-        "COALESCE(description, '') "
-        "FROM command_payload_fields "
-        "WHERE command_id = ? "
-        "ORDER BY payload_offset, ordinal");
-    fields.bindInt(1, command.commandId);
-
-    while (fields.step()) {
-      CommandParameter parameter;
-      parameter.ordinal = sqlite3_column_int(fields.stmt, 0);
-      parameter.payloadOffset = sqlite3_column_int(fields.stmt, 1);
-      parameter.fieldName = sqliteText(fields.stmt, 2);
-      parameter.fieldRole = sqliteText(fields.stmt, 3);
-      parameter.valueExpr = sqliteText(fields.stmt, 4);
-      parameter.valueHex = sqliteText(fields.stmt, 5);
-      parameter.conditionExpr = sqliteText(fields.stmt, 6);
-      parameter.omitIfMinusOne = sqlite3_column_int(fields.stmt, 7) != 0;
-      parameter.description = sqliteText(fields.stmt, 8);
-      command.parameters.push_back(std::move(parameter));
-    }
+  std::vector<CommandInfo> commands = loadSqliteCommands(dbPath_);
+
+  for (auto &command : commands) {
+    command.aliases = generatedAliasesFor(command);
+    addUnique(command.aliases, command.canonicalName);
   }
+
+  storage_ = std::make_shared<CatalogueStorage>(
+      CatalogueCompiler().compile(commands));
+  tables_ = viewOf(*storage_);
+  std::call_once(commandCache_->once, [&]() {
+    commandCache_->commands = std::move(commands);
+  });
 }
 
-void CommandDatabase::indexAliases() {
-  std::map<std::string, std::vector<std::size_t>> owners;
-  for (std::size_t i = 0; i < commands_.size(); ++i) {
-    commands_[i].aliases = generatedAliasesFor(commands_[i]);
-    addUnique(commands_[i].aliases, commands_[i].canonicalName);
-    std::set<std::string> normalizedForCommand;
-    for (const auto &alias : commands_[i].aliases) {
-      std::string normalized = normalizeKey(alias);
-      if (normalizedForCommand.insert(normalized).second)
-        owners[normalized].push_back(i);
-    }
-  }
+const std::vector<CommandInfo> &CommandDatabase::commands() const {
+  std::call_once(commandCache_->once, [this]() {
+    commandCache_->commands = commandsFromTables(tables_);
+  });
+  return commandCache_->commands;
+}
 
-  for (const auto &[alias, indexes] : owners) {
-    if (indexes.size() == 1) {
-      uniqueAliases_[alias] = indexes.front();
-      continue;
-    }
+BuildErrc CommandDatabase::findIndex(std::string_view name,
+                                     std::size_t &index) const {
+  int32_t alias = findAlias(tables_, name);
+  if (alias < 0)
+    return BuildErrc::UnknownCommand;
+  int32_t command = tables_.aliases[alias].command;
+  if (command < 0)
+    return BuildErrc::AmbiguousCommand;
+  index = static_cast<std::size_t>(command);
+  return BuildErrc::Ok;
+}
 
-    std::vector<std::string> names;
-    for (std::size_t index : indexes)
-      addUnique(names, commands_[index].canonicalName);
-    ambiguousAliases_[alias] = std::move(names);
+std::size_t CommandDatabase::resolveIndex(const std::string &name) const {
+  std::size_t index = 0;
+  BuildErrc code = findIndex(name, index);
+  if (code == BuildErrc::Ok)
+    return index;
+  if (code == BuildErrc::UnknownCommand)
+    throw std::runtime_error("unknown command: " + name);
+
+  const AliasRecord *found = &tables_.aliases[findAlias(tables_, name)];
+  std::ostringstream message;
+  message << "ambiguous command alias '" << name << "' matches";
+  for (uint32_t i = 0; i < found->candidates.count; ++i) {
+    uint32_t candidate = tables_.aliasCandidates[found->candidates.begin + i];
+    message << " " << tables_.textOf(tables_.commands[candidate].canonicalName);
   }
+  throw std::runtime_error(message.str());
 }
 
 const CommandInfo &CommandDatabase::resolveCommand(
     const std::string &name) const {
-  std::string key = normalizeKey(name);
-  auto found = uniqueAliases_.find(key);
-  if (found != uniqueAliases_.end())
-    return commands_[found->second];
+  std::size_t index = resolveIndex(name);
+  return commands()[index];
+}
 
-  auto ambiguous = ambiguousAliases_.find(key);
-  if (ambiguous != ambiguousAliases_.end()) {
-    std::ostringstream message;
-    message << "ambiguous command alias '" << name << "' matches";
-    for (const auto &candidate : ambiguous->second)
-      message << " " << candidate;
-    throw std::runtime_error(message.str());
-  }
+std::size_t
+CommandDatabase::argumentSlotCount(const std::string &command) const {
+  return tables_.plans[resolveIndex(command)].argumentKeys.count;
+}
 
-  throw std::runtime_error("unknown command: " + name);
+std::optional<std::size_t>
+CommandDatabase::argumentSlot(const std::string &command,
+                              std::string_view argument) const {
+  const CommandPlan &plan = tables_.plans[resolveIndex(command)];
+  int32_t slot = findArgumentSlot(tables_, plan.argumentKeys, argument);
+  if (slot < 0)
+    return std::nullopt;
+  return static_cast<std::size_t>(slot);
 }
 
 BuiltCommand CommandDatabase::buildCommand(const std::string &name,
                                            const CommandArgs &args) const {
-  const CommandInfo &command = resolveCommand(name);
-  ArgumentBag bag(args);
-  BuildContext context;
+  std::size_t index = resolveIndex(name);
+  const CommandPlan &plan = tables_.plans[index];
+  BoundArguments slots;
+  TextArguments arguments(bindArguments(tables_, plan, args, slots));
+  return frameFor(index, PlanExecutor(tables_, plan, arguments).run());
+}
 
-  CommandPayload payload;
-  payload.commandMode = parseByteLiteral(command.commandModeHex);
-  context.set("commandMode", payload.commandMode);
+BuildResult<BuiltCommand>
+CommandDatabase::tryBuildCommand(const std::string &name,
+                                 const CommandArgs &args) const {
+  std::size_t index = 0;
+  if (BuildErrc code = findIndex(name, index); code != BuildErrc::Ok)
+    return BuildError{.code = code};
+  const CommandPlan &plan = tables_.plans[index];
+  BoundArguments slots;
+  TextArguments arguments(bindArguments(tables_, plan, args, slots));
+  BuildScratch &scratch = buildScratch();
+  PlanExecutor executor(tables_, plan, arguments);
+  executor.keepArraysIn(scratch.arrayBytes);
+  if (!executor.tryRun(scratch.payload))
+    return executor.error();
+  return frameFor(index, scratch.payload);
+}
 
-  for (const auto &field : command.parameters) {
-    if (isCommandModeField(field))
+BuildResult<BuiltCommand>
+CommandDatabase::tryBuildCommand(const std::string &name,
+                                 ArgumentSlots arguments) const {
+  std::size_t index = 0;
+  if (BuildErrc code = findIndex(name, index); code != BuildErrc::Ok)
+    return BuildError{.code = code};
+  const CommandPlan &plan = tables_.plans[index];
+  if (arguments.size() > plan.argumentKeys.count)
+    return BuildError{.code = BuildErrc::ArgumentCount};
+  TextArguments text(arguments);
+  BuildScratch &scratch = buildScratch();
+  PlanExecutor executor(tables_, plan, text);
+  executor.keepArraysIn(scratch.arrayBytes);
+  if (!executor.tryRun(scratch.payload))
+    return executor.error();
+  return frameFor(index, scratch.payload);
+}
+
+ScatterCommand
+CommandDatabase::buildScatterCommand(const std::string &name,
+                                     const CommandArgs &args,
+                                     std::span<const uint8_t> arrayBytes) const {
+  std::size_t index = resolveIndex(name);
+  const CommandRecord &command = tables_.commands[index];
+  const CommandPlan &plan = tables_.plans[index];
+  BoundArguments slots;
+  BorrowedArrayArguments arguments(bindArguments(tables_, plan, args, slots));
+  PlanExecutor executor(tables_, plan, arguments);
+  CommandPayload payload = executor.run();
+  std::optional<std::size_t> at = executor.borrowedAt();
+  if (!at)
+    throw std::runtime_error("command has no array argument: " +
+                             std::string(tables_.textOf(command.canonicalName)));
+  if (arrayBytes.empty())
+    throw std::runtime_error("array argument must contain at least one byte");
+
+  // Every field but the array adds at most one byte.
+  std::array<uint8_t, kMaxPlanFields + 1> bytes;
+  bytes[0] = payload.commandMode;
+  std::copy(payload.orderedBytes.begin(), payload.orderedBytes.end(),
+            bytes.begin() + 1);
+  std::span<const uint8_t> fixed(bytes.data(), 1 + payload.orderedBytes.size());
+
+  ScatterCommand built;
+  built.canonicalName = tables_.textOf(command.canonicalName);
+  built.targetName = tables_.textOf(command.targetName);
+  built.ackFlag = plan.ackFlag;
+  if (plan.hasRouteTag)
+    built.routeTag = plan.routeTag;
+  built.frame = buildScatterFrame(plan.ackFlag, fixed.first(1 + *at),
+                                  arrayBytes, fixed.subspan(1 + *at));
+  return built;
+}
+
+CommandBatch
+CommandDatabase::buildBatch(std::span<const CommandRequest> requests) const {
+  CommandBatch batch;
+  buildBatch(requests, batch);
+  return batch;
+}
+
+void CommandDatabase::buildBatch(std::span<const CommandRequest> requests,
+                                 CommandBatch &batch) const {
+  batch.bytes.clear();
+  batch.frames.resize(requests.size());
+
+  BuildScratch &scratch = buildScratch();
+  for (std::size_t i = 0; i < requests.size(); ++i) {
+    BatchFrame &frame = batch.frames[i];
+    frame = BatchFrame{};
+    frame.offset = static_cast<uint32_t>(batch.bytes.size());
+    std::size_t index = 0;
+    if (BuildErrc code = findIndex(requests[i].name, index);
+        code != BuildErrc::Ok) {
+      frame.error.code = code;
       continue;
-    if (!field.conditionExpr.empty())
+    }
+    const CommandPlan &plan = tables_.plans[index];
+    BoundArguments slots;
+    TextArguments arguments(
+        bindArguments(tables_, plan, requests[i].args, slots));
+    PlanExecutor executor(tables_, plan, arguments);
+    executor.keepArraysIn(scratch.arrayBytes);
+    if (!executor.tryRun(scratch.payload)) {
+      frame.error = executor.error();
       continue;
-    auto bytes = resolveFieldBytes(command, field, bag, context, false);
-    if (bytes)
-      rememberSingleByte(context, field, *bytes);
+    }
+
+    const CommandPayload &payload = scratch.payload;
+    batch.bytes.resize(frame.offset + FrameWriter::commandFrameSize(payload));
+    FrameWriter(std::span<uint8_t>(batch.bytes).subspan(frame.offset))
+        .writeCommand(payload, plan.ackFlag);
+    if (plan.hasRouteTag)
+      frame.routeTag = plan.routeTag;
+    frame.canonicalName = tables_.textOf(tables_.commands[index].canonicalName);
+    frame.ackFlag = plan.ackFlag;
+    frame.ok = true;
+    frame.length = static_cast<uint32_t>(batch.bytes.size() - frame.offset);
   }
+}
 
-  for (const auto &field : command.parameters) {
-    if (isCommandModeField(field))
-      continue;
+std::string
+CommandDatabase::buildErrorMessage(const CommandRequest &request) const {
+  try {
+    buildCommand(request.name, request.args);
+    return {};
+  } catch (const std::exception &ex) {
+    return ex.what();
+  }
+}
 
-    if (!field.conditionExpr.empty() &&
-        !evalCondition(field.conditionExpr, command, bag, context))
-      continue;
+BuiltCommand CommandDatabase::buildCommand(const std::string &name,
+                                           ArgumentSlots arguments) const {
+  std::size_t index = resolveIndex(name);
+  if (arguments.size() > tables_.plans[index].argumentKeys.count)
+    throw std::runtime_error("too many argument slots for command: " +
+                             std::string(tables_.textOf(
+                                 tables_.commands[index].canonicalName)));
+  TextArguments text(arguments);
+  return frameFor(index,
+                  PlanExecutor(tables_, tables_.plans[index], text).run());
+}
+
+PreparedCommand
+CommandDatabase::prepare(const std::string &name,
+                         std::span<const std::string_view> arguments) const {
+  std::size_t index = resolveIndex(name);
+  const CommandPlan &plan = tables_.plans[index];
+  std::string canonicalName(
+      tables_.textOf(tables_.commands[index].canonicalName));
+
+  PreparedCommand prepared;
+  prepared.db_ = this;
+  prepared.command_ = static_cast<uint32_t>(index);
+  uint64_t bound = 0;
+  for (std::string_view argument : arguments) {
+    int32_t slot = findArgumentSlot(tables_, plan.argumentKeys, argument);
+    if (slot < 0)
+      throw std::runtime_error("unknown argument '" + std::string(argument) +
+                               "' for command: " + canonicalName);
+    if ((bound >> slot) & 1)
+      throw std::runtime_error("argument '" + std::string(argument) +
+                               "' bound twice for command: " + canonicalName);
+    bound |= uint64_t{1} << slot;
+    prepared.slots_[prepared.count_++] = static_cast<uint8_t>(slot);
+  }
+  return prepared;
+}
+
+BuiltCommand PreparedCommand::build(std::span<const int64_t> values) const {
+  return buildTraced(values, nullptr);
+}
+
+uint64_t
+PreparedCommand::bindValues(std::span<const int64_t> values,
+                            std::array<int64_t, kMaxArgumentSlots> &bySlot) const {
+  uint64_t present = 0;
+  for (uint32_t i = 0; i < count_; ++i) {
+    bySlot[slots_[i]] = values[i];
+    present |= uint64_t{1} << slots_[i];
+  }
+  return present;
+}
+
+BuiltCommand PreparedCommand::buildTraced(std::span<const int64_t> values,
+                                          FrameTrace *trace) const {
+  if (!db_)
+    throw std::runtime_error("prepared command is empty");
+  if (values.size() != count_)
+    throw std::runtime_error("prepared command expects " +
+                             std::to_string(count_) + " values, got " +
+                             std::to_string(values.size()));
+
+  std::array<int64_t, kMaxArgumentSlots> bySlot;
+  NumericArguments arguments(bySlot.data(), bindValues(values, bySlot));
+  BuildScratch &scratch = buildScratch();
+  PlanExecutor executor(db_->tables_, db_->tables_.plans[command_], arguments,
+                        trace);
+  executor.keepArraysIn(scratch.arrayBytes);
+  executor.run(scratch.payload);
+  return db_->frameFor(command_, scratch.payload);
+}
+
+BuildResult<BuiltCommand>
+PreparedCommand::tryBuild(std::span<const int64_t> values) const {
+  if (!db_)
+    return BuildError{.code = BuildErrc::UnknownCommand};
+  if (values.size() != count_)
+    return BuildError{.code = BuildErrc::ArgumentCount};
+
+  std::array<int64_t, kMaxArgumentSlots> bySlot;
+  NumericArguments arguments(bySlot.data(), bindValues(values, bySlot));
+  BuildScratch &scratch = buildScratch();
+  PlanExecutor executor(db_->tables_, db_->tables_.plans[command_], arguments);
+  executor.keepArraysIn(scratch.arrayBytes);
+  if (!executor.tryRun(scratch.payload)) {
+    BuildError error = executor.error();
+    if (error.argument >= 0)
+      error.argument = static_cast<int32_t>(
+          std::find(slots_.begin(), slots_.begin() + count_, error.argument) -
+          slots_.begin());
+    return error;
+  }
+  return db_->frameFor(command_, scratch.payload);
+}
+
+bool FrameTemplate::matches(const Layout &layout,
+                            std::span<const int64_t> values) const {
+  for (std::size_t i = 0; i < values.size(); ++i)
+    if (((layout.structural >> i) & 1) && values[i] != layout.values[i])
+      return false;
+  return true;
+}
+
+bool FrameTemplate::patch(Layout &layout, std::span<const int64_t> values) {
+  for (std::size_t i = 0; i < values.size(); ++i)
+    if (values[i] < 0 || values[i] > layout.limits[i])
+      return false;
+  for (const Patch &p : layout.patches)
+    if (((values[p.argument] >> p.shift) & 0xFF) == 0xFF)
+      return false;
 
-    auto bytes = resolveFieldBytes(command, field, bag, context, true);
-    if (!bytes)
+  Frame &bytes = layout.built.bytes;
+  unsigned checksum = bytes[layout.checksumOffset];
+  for (const Patch &p : layout.patches) {
+    uint8_t byte = static_cast<uint8_t>(values[p.argument] >> p.shift);
+    checksum += byte - bytes[p.offset];
+    bytes[p.offset] = byte;
+  }
+  bytes[layout.checksumOffset] = static_cast<uint8_t>(checksum);
+  layout.values.assign(values.begin(), values.end());
+  return true;
+}
+
+// Locates the argument-derived bytes of a freshly built frame. Fails when one
+// of them is 0xFF, since the assembler drops those and the frame would change
+// length when the value does.
+bool FrameTemplate::makeLayout(const FrameTrace &trace,
+                               std::span<const int64_t> values,
+                               BuiltCommand built, Layout &layout) const {
+  layout.built = std::move(built);
+  std::array<int32_t, kMaxArgumentSlots> argumentOf;
+  argumentOf.fill(-1);
+  for (uint32_t i = 0; i < command_.count_; ++i)
+    argumentOf[command_.slots_[i]] = static_cast<int32_t>(i);
+
+  layout.structural = 0;
+  layout.limits.assign(values.size(), INT64_MAX);
+  for (uint32_t i = 0; i < command_.count_; ++i) {
+    uint32_t slot = command_.slots_[i];
+    if ((trace.structural >> slot) & 1)
+      layout.structural |= uint64_t{1} << i;
+    layout.limits[i] = trace.limits[slot];
+  }
+
+  std::size_t dataBytes = trace.commandMode != 0xFF;
+  for (const auto &byte : trace.payload) {
+    if (byte.value != 0xFF)
+      ++dataBytes;
+    else if (byte.source >= 0)
+      return false;
+  }
+
+  layout.checksumOffset = layout.built.bytes.size() - 1;
+  std::size_t offset =
+      layout.checksumOffset - dataBytes + (trace.commandMode != 0xFF);
+  layout.patches.clear();
+  for (const auto &byte : trace.payload) {
+    if (byte.value == 0xFF)
       continue;
+    if (byte.source >= 0)
+      layout.patches.push_back({static_cast<uint32_t>(offset),
+                                static_cast<uint8_t>(argumentOf[byte.source]),
+                                byte.shift});
+    ++offset;
+  }
+
+  layout.values.assign(values.begin(), values.end());
+  return true;
+}
 
-    for (uint8_t byte : *bytes)
-      payload.orderedBytes.push_back(static_cast<int8_t>(byte));
-    rememberSingleByte(context, field, *bytes);
+const BuiltCommand &FrameTemplate::update(std::span<const int64_t> values) {
+  patched_ = false;
+  if (values.size() == command_.count_) {
+    for (Layout &layout : layouts_) {
+      if (!matches(layout, values))
+        continue;
+      if (patch(layout, values)) {
+        patched_ = true;
+        return layout.built;
+      }
+      break;
+    }
   }
 
-  BuiltCommand built;
-  built.canonicalName = command.canonicalName;
-  built.targetName = command.targetName;
-  built.ackFlag = command.ackDefaultHex.empty()
-                      ? 0x01
-                      : parseByteLiteral(command.ackDefaultHex);
+  FrameTrace trace;
+  BuiltCommand built = command_.buildTraced(values, &trace);
+  Layout layout;
+  if (!makeLayout(trace, values, std::move(built), layout)) {
+    unpatchable_ = std::move(layout.built);
+    return unpatchable_;
+  }
 
-  if (command.routeTagHex.empty()) {
-    built.bytes = assembleUsbFrameFromCommand(payload, built.ackFlag);
-  } else {
-    built.routeTag = parseByteLiteral(command.routeTagHex);
-    built.bytes = assembleRoutedBuffer(payload, built.ackFlag, *built.routeTag);
+  for (Layout &existing : layouts_) {
+    if (matches(existing, values)) {
+      existing = std::move(layout);
+      return existing.built;
+    }
   }
+  if (layouts_.size() < kMaxLayouts) {
+    layouts_.push_back(std::move(layout));
+    return layouts_.back().built;
+  }
+  Layout &evicted = layouts_[nextEvicted_];
+  nextEvicted_ = (nextEvicted_ + 1) % kMaxLayouts;
+  evicted = std::move(layout);
+  return evicted.built;
+}
+
+BuiltCommand CommandDatabase::frameFor(std::size_t index,
+                                       const CommandPayload &payload) const {
+  const CommandRecord &command = tables_.commands[index];
+  const CommandPlan &plan = tables_.plans[index];
 
+  BuiltCommand built;
+  built.canonicalName = tables_.textOf(command.canonicalName);
+  built.targetName = tables_.textOf(command.targetName);
+  built.ackFlag = plan.ackFlag;
+
+  if (plan.hasRouteTag)
+    built.routeTag = plan.routeTag;
+  built.bytes.resize(FrameWriter::commandFrameSize(payload));
+  FrameWriter(built.bytes.bytes()).writeCommand(payload, built.ackFlag);
   return built;
 }
 
+void CommandDatabase::writeSnapshot(const std::string &snapshotPath) const {
+  CatalogueSnapshot::write(snapshotPath, dbPath_, tables_);
+}
+
 } // namespace sanbot
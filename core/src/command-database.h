@@ -1,15 +1,31 @@
 #pragma once
 
+#include "catalogue-tables.h"
+#include "frame.h"
+
+#include <array>
+#include <concepts>
 #include <cstdint>
+#include <initializer_list>
 #include <map>
+#include <memory>
 #include <optional>
+#include <span>
 #include <string>
+#include <string_view>
 #include <vector>
 
+struct CommandPayload;
+
 namespace sanbot {
 
 using CommandArgs = std::map<std::string, std::string>;
 
+// Arguments bound by slot number (see CommandDatabase::argumentSlot); an empty
+// optional leaves that argument unset. The views only need to outlive the
+// buildCommand call.
+using ArgumentSlots = std::span<const std::optional<std::string_view>>;
+
 struct CommandParameter {
   int ordinal = 0;
   int payloadOffset = 0;
@@ -37,36 +53,305 @@ struct CommandInfo {
   std::vector<CommandParameter> parameters;
 };
 
+// bytes is the USB frame as transmitted. The route tag selects the device
+// (0x01 head, 0x02 bottom, 0x03 both) and travels beside the frame;
+// wireBytes() gives the older routed form with the tag appended as a
+// trailing byte, as assembleRoutedBuffer produces it.
 struct BuiltCommand {
   std::string canonicalName;
   std::string targetName;
   uint8_t ackFlag = 0x01;
   std::optional<uint8_t> routeTag;
-  std::vector<uint8_t> bytes;
+  Frame bytes;
 
   bool hasRouteTag() const { return routeTag.has_value(); }
+
+  Frame wireBytes() const {
+    Frame wire = bytes;
+    if (routeTag)
+      wire.push_back(*routeTag);
+    return wire;
+  }
+};
+
+// A command whose array argument (data[], version[]) is borrowed from the
+// caller instead of parsed from text; see ScatterFrame.
+struct ScatterCommand {
+  std::string canonicalName;
+  std::string targetName;
+  uint8_t ackFlag = 0x01;
+  std::optional<uint8_t> routeTag;
+  ScatterFrame frame;
+};
+
+struct CommandRequest {
+  std::string name;
+  CommandArgs args;
+};
+
+// Why a build failed, as reported by the non-throwing build calls. field is
+// the index of the parameter concerned in CommandInfo::parameters, argument
+// the slot whose value was rejected (for a PreparedCommand, its position among
+// the values) and limit the largest value that argument accepts; each is -1
+// or 0 when it does not apply. detail refers to catalogue text naming what
+// was missing or unsupported. InvalidValue is a value without digits or too
+// large for 64 bits, TrailingCharacters one with digits followed by anything
+// else (including 8 or 9 in an octal literal).
+enum class BuildErrc : uint8_t {
+  Ok,
+  UnknownCommand,
+  AmbiguousCommand,
+  ArgumentCount,
+  MissingArgument,
+  MissingArrayArgument,
+  MissingConditionArgument,
+  EmptyValue,
+  InvalidValue,
+  TrailingCharacters,
+  OutOfRange,
+  EmptyArray,
+  MultipleArrays,
+  Unsupported,
+};
+
+struct BuildError {
+  BuildErrc code = BuildErrc::Ok;
+  int32_t field = -1;
+  int32_t argument = -1;
+  uint32_t limit = 0;
+  TextRef detail{};
+};
+
+// One entry of a CommandBatch: the frame occupies bytes [offset, offset +
+// length) of the batch buffer; the route tag is kept beside it as in
+// BuiltCommand. Failed requests have ok == false, length 0 and the reason in
+// error; CommandDatabase::buildErrorMessage gives the text buildCommand
+// would throw.
+struct BatchFrame {
+  uint32_t offset = 0;
+  uint32_t length = 0;
+  bool ok = false;
+  uint8_t ackFlag = 0x01;
+  std::optional<uint8_t> routeTag;
+  std::string_view canonicalName;
+  BuildError error;
+};
+
+// Frames built by CommandDatabase::buildBatch, laid out back to back in one
+// buffer. Passing the same batch to later calls reuses its allocations.
+// canonicalName views point into the database's catalogue.
+struct CommandBatch {
+  std::vector<uint8_t> bytes;
+  std::vector<BatchFrame> frames;
+
+  std::span<const uint8_t> frame(std::size_t index) const {
+    return std::span<const uint8_t>(bytes).subspan(frames[index].offset,
+                                                   frames[index].length);
+  }
+};
+
+// The built value or the error that stopped the build, after std::expected.
+// value() and the dereference operators require has_value().
+template <typename T> class BuildResult {
+public:
+  BuildResult(T value) : value_(std::move(value)) {}
+  BuildResult(const BuildError &error) : error_(error) {}
+
+  bool has_value() const { return value_.has_value(); }
+  explicit operator bool() const { return has_value(); }
+
+  T &value() { return *value_; }
+  const T &value() const { return *value_; }
+  T &operator*() { return *value_; }
+  const T &operator*() const { return *value_; }
+  T *operator->() { return &*value_; }
+  const T *operator->() const { return &*value_; }
+
+  const BuildError &error() const { return error_; }
+
+private:
+  std::optional<T> value_;
+  BuildError error_;
 };
 
+class CatalogueSnapshot;
+class CommandDatabase;
+struct FrameTrace;
+
+// A command with its name and argument layout resolved once, built from
+// numeric values given in the order the arguments were named to
+// CommandDatabase::prepare. Successful builds do no name or alias lookups and
+// throw nothing; out-of-range values throw from build and are returned as a
+// BuildError from tryBuild. The handle refers to the database and must not
+// outlive it.
+class PreparedCommand {
+public:
+  std::size_t argumentCount() const { return count_; }
+
+  template <std::integral... Values>
+  BuiltCommand build(Values... values) const {
+    std::array<int64_t, sizeof...(Values)> list{
+        static_cast<int64_t>(values)...};
+    return build(std::span<const int64_t>(list));
+  }
+  BuiltCommand build(std::span<const int64_t> values) const;
+
+  template <std::integral... Values>
+  BuildResult<BuiltCommand> tryBuild(Values... values) const {
+    std::array<int64_t, sizeof...(Values)> list{
+        static_cast<int64_t>(values)...};
+    return tryBuild(std::span<const int64_t>(list));
+  }
+  BuildResult<BuiltCommand> tryBuild(std::span<const int64_t> values) const;
+
+private:
+  friend class CommandDatabase;
+  friend class FrameTemplate;
+
+  uint64_t bindValues(std::span<const int64_t> values,
+                      std::array<int64_t, kMaxArgumentSlots> &bySlot) const;
+
+  BuiltCommand buildTraced(std::span<const int64_t> values,
+                           FrameTrace *trace) const;
+
+  const CommandDatabase *db_ = nullptr;
+  uint32_t command_ = 0;
+  uint32_t count_ = 0;
+  std::array<uint8_t, kMaxArgumentSlots> slots_{};
+};
+
+// Keeps the assembled frames of a prepared command and updates them in place
+// when only argument values change: the bytes copied from arguments are
+// patched and the checksum adjusted by the difference. One frame is kept per
+// combination of the values that steer the build (the mode, anything a
+// condition reads), up to kMaxLayouts. Changing a steering value, or a value
+// that would put 0xFF in the payload (the assembler drops those), falls back
+// to a full build. The returned frame is valid until the next update.
+class FrameTemplate {
+public:
+  static constexpr std::size_t kMaxLayouts = 8;
+
+  explicit FrameTemplate(const PreparedCommand &command) : command_(command) {
+    layouts_.reserve(kMaxLayouts);
+  }
+
+  template <std::integral... Values>
+  const BuiltCommand &update(Values... values) {
+    std::array<int64_t, sizeof...(Values)> list{
+        static_cast<int64_t>(values)...};
+    return update(std::span<const int64_t>(list));
+  }
+  const BuiltCommand &update(std::span<const int64_t> values);
+
+  // Whether the last update patched a kept frame instead of rebuilding.
+  bool lastUpdatePatched() const { return patched_; }
+
+private:
+  struct Patch {
+    uint32_t offset;
+    uint8_t argument;
+    uint8_t shift;
+  };
+
+  struct Layout {
+    uint64_t structural = 0;
+    std::vector<int64_t> values;
+    std::vector<int64_t> limits;
+    std::vector<Patch> patches;
+    std::size_t checksumOffset = 0;
+    BuiltCommand built;
+  };
+
+  PreparedCommand command_;
+  std::vector<Layout> layouts_;
+  std::size_t nextEvicted_ = 0;
+  BuiltCommand unpatchable_;
+  bool patched_ = false;
+
+  bool matches(const Layout &layout, std::span<const int64_t> values) const;
+  bool patch(Layout &layout, std::span<const int64_t> values);
+  bool makeLayout(const FrameTrace &trace, std::span<const int64_t> values,
+                  BuiltCommand built, Layout &layout) const;
+};
+
+enum class SnapshotPolicy {
+  Ignore,
+  UseIfCurrent,
+};
+
+struct EmbeddedCatalogue {};
+
 class CommandDatabase {
 public:
-  explicit CommandDatabase(const std::string &dbPath);
+  explicit CommandDatabase(
+      const std::string &dbPath,
+      SnapshotPolicy snapshotPolicy = SnapshotPolicy::UseIfCurrent);
+  explicit CommandDatabase(EmbeddedCatalogue);
 
   static std::string findDefaultDatabasePath(const std::string &startDir = {});
+  static std::string snapshotPathFor(const std::string &dbPath);
+  static bool hasEmbeddedCatalogue();
 
   const std::string &path() const { return dbPath_; }
-  const std::vector<CommandInfo> &commands() const { return commands_; }
+  bool loadedFromSnapshot() const { return snapshot_ != nullptr; }
+  const CatalogueTables &tables() const { return tables_; }
+  const std::vector<CommandInfo> &commands() const;
   const CommandInfo &resolveCommand(const std::string &name) const;
   BuiltCommand buildCommand(const std::string &name,
                             const CommandArgs &args) const;
 
+  // Slot layout of a command's arguments, fixed for a given catalogue.
+  std::size_t argumentSlotCount(const std::string &command) const;
+  std::optional<std::size_t> argumentSlot(const std::string &command,
+                                          std::string_view argument) const;
+  BuiltCommand buildCommand(const std::string &name,
+                            ArgumentSlots arguments) const;
+  ScatterCommand buildScatterCommand(const std::string &name,
+                                     const CommandArgs &args,
+                                     std::span<const uint8_t> arrayBytes) const;
+
+  // Build as buildCommand does, but report failures as a BuildError instead
+  // of throwing. A failed build does not throw, and allocates only if it
+  // outgrows the per-thread scratch buffers earlier builds left behind.
+  BuildResult<BuiltCommand> tryBuildCommand(const std::string &name,
+                                            const CommandArgs &args) const;
+  BuildResult<BuiltCommand> tryBuildCommand(const std::string &name,
+                                            ArgumentSlots arguments) const;
+
+  // Requests that fail are recorded in their BatchFrame; the batch itself
+  // never throws for them.
+  CommandBatch buildBatch(std::span<const CommandRequest> requests) const;
+  void buildBatch(std::span<const CommandRequest> requests,
+                  CommandBatch &batch) const;
+  // The message buildCommand would throw for request, or an empty string if
+  // it builds.
+  std::string buildErrorMessage(const CommandRequest &request) const;
+
+  PreparedCommand prepare(const std::string &name,
+                          std::span<const std::string_view> arguments) const;
+  PreparedCommand
+  prepare(const std::string &name,
+          std::initializer_list<std::string_view> arguments) const {
+    return prepare(name, std::span<const std::string_view>(arguments.begin(),
+                                                           arguments.size()));
+  }
+
+  void writeSnapshot(const std::string &snapshotPath) const;
+
 private:
+  friend class PreparedCommand;
+  struct CommandCache;
+
   std::string dbPath_;
-  std::vector<CommandInfo> commands_;
-  std::map<std::string, std::size_t> uniqueAliases_;
-  std::map<std::string, std::vector<std::string>> ambiguousAliases_;
+  std::shared_ptr<const CatalogueStorage> storage_;
+  std::shared_ptr<const CatalogueSnapshot> snapshot_;
+  std::shared_ptr<CommandCache> commandCache_;
+  CatalogueTables tables_;
 
   void load();
-  void indexAliases();
+  std::size_t resolveIndex(const std::string &name) const;
+  BuildErrc findIndex(std::string_view name, std::size_t &index) const;
+  BuiltCommand frameFor(std::size_t index, const CommandPayload &payload) const;
 };
 
 CommandArgs parseCommandArgs(const std::vector<std::string> &tokens);
@@ -168,10 +168,13 @@ vector<uint8_t> buildHeadLocateRelative(uint8_t action, uint8_t hAngle,
   return assembleCommand(0x02, ordered, 0x01);
 }
 
+static_assert(kHeadCentreLockFrame ==
+              array<uint8_t, 26>{0xA4, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00,
+                                 0x09, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00,
+                                 0x00, 0x00, 0xFF, 0xA5, 0x01, 0x00, 0x04,
+                                 0x02, 0x20, 0x01, 0xCC, 0x01});
+
 vector<uint8_t> buildHeadCentreLock() {
-  uint8_t mode = 0x20;
-  uint8_t action = 0x01;
-  vector<int8_t> ordered = {static_cast<int8_t>(mode),
-                            static_cast<int8_t>(action)};
-  return assembleCommand(0x02, ordered, 0x01);
+  return vector<uint8_t>(kHeadCentreLockFrame.begin(),
+                         kHeadCentreLockFrame.end());
 }
@@ -1,8 +1,15 @@
 #pragma once
+#include "packet-assembler.h"
+#include <array>
 #include <cstdint>
 #include <vector>
 using namespace std;
 
+// Commands without variable fields, assembled at compile time.
+inline constexpr auto kHeadCentreLockFrame = appendPointTagForRouting(
+    buildUsbFrame(UsbFrameParams{0x01}, array<uint8_t, 3>{0x02, 0x20, 0x01}),
+    0x01);
+
 vector<uint8_t> buildWheelNoAngle(uint8_t action, uint8_t speed,
                                   uint16_t duration, uint8_t durationMode);
 vector<uint8_t> buildWheelRelativeAngle(uint8_t action, uint8_t speed,
@@ -0,0 +1,18 @@
+#include "embedded-catalogue.h"
+
+#ifdef SANBOT_HAVE_EMBEDDED_CATALOGUE
+#include "sanbot-catalogue-data.h"
+#endif
+
+namespace sanbot {
+
+const CatalogueTables *embeddedCatalogueTables() {
+#ifdef SANBOT_HAVE_EMBEDDED_CATALOGUE
+  static constexpr CatalogueTables tables = generated::catalogueTables();
+  return &tables;
+#else
+  return nullptr;
+#endif
+}
+
+} // namespace sanbot
@@ -0,0 +1,12 @@
+#pragma once
+
+#include "catalogue-tables.h"
+
+namespace sanbot {
+
+// The catalogue compiled into the library from the checked-in database by the
+// sanbot-catalogue-gen build step, or nullptr when the library was configured
+// without SANBOT_EMBED_CATALOGUE.
+const CatalogueTables *embeddedCatalogueTables();
+
+} // namespace sanbot
@@ -0,0 +1,43 @@
+#include "frame-parser.h"
+
+#include <algorithm>
+
+UsbFrameParser::UsbFrameParser(std::size_t maxFrameSize)
+    : maxFrameSize_(std::max(maxFrameSize, kHeaderSize + 1)) {
+  carry_.reserve(maxFrameSize_);
+}
+
+void UsbFrameParser::reset() {
+  carry_.clear();
+  stats_ = {};
+}
+
+UsbFrameParser::Header
+UsbFrameParser::checkHeader(std::span<const uint8_t> data,
+                            std::size_t &length) const {
+  if (data.size() >= 2 && data[1] != 0x03)
+    return Header::Bad;
+  if (data.size() >= 18 && (data[16] != 0xFF || data[17] != 0xA5))
+    return Header::Bad;
+  if (data.size() < kHeaderSize)
+    return Header::Incomplete;
+
+  uint32_t messageSize = static_cast<uint32_t>(data[4]) << 24 |
+                         static_cast<uint32_t>(data[5]) << 16 |
+                         static_cast<uint32_t>(data[6]) << 8 | data[7];
+  uint32_t mmnn = static_cast<uint32_t>(data[19]) << 8 | data[20];
+  // MessageSize is payload + 6 and Mmnn payload + 1.
+  if (messageSize < 6 || mmnn != messageSize - 5)
+    return Header::Bad;
+  if (16 + std::size_t{messageSize} > maxFrameSize_)
+    return Header::Oversized;
+  length = 16 + std::size_t{messageSize};
+  return Header::Ok;
+}
+
+std::size_t UsbFrameParser::carryWanted() const {
+  std::size_t length = 0;
+  if (checkHeader(carry_, length) == Header::Ok)
+    return length;
+  return kHeaderSize;
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include "byte-sum.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <vector>
+
+// A complete frame as received from the MCU. The views point into the chunk
+// given to UsbFrameParser::feed, or into the parser's carry buffer for a
+// frame split across reads, and are valid only during the callback.
+struct ReceivedFrame {
+  std::span<const uint8_t> bytes;
+  uint8_t ackFlag = 0;
+  std::span<const uint8_t> payload;
+};
+
+struct FrameParserStats {
+  uint64_t frames = 0;
+  uint64_t discardedBytes = 0;
+  // A4 03 not followed by FF A5 and agreeing MessageSize / Mmnn fields.
+  uint64_t badHeaders = 0;
+  uint64_t oversized = 0;
+  uint64_t badChecksums = 0;
+};
+
+// Splits the byte stream of bulk reads into MCU frames. Chunks may hold
+// several frames, part of one, or junk: the parser looks for the A4 03 type,
+// checks the FF A5 head and that MessageSize and Mmnn agree, and verifies the
+// checksum as ConvertUtils.isComplete does (the low byte of the sum of bytes
+// 16 through the one before the checksum). That is deliberately not
+// validateUsbFrame's rule, which follows the sending side and adds Mmnn as
+// one 16-bit value: the two agree only while Mmnn's high byte is zero, so a
+// frame with 255 or more payload bytes as this assembler builds it counts
+// here as a bad checksum. Anything that fails is skipped a byte at a time
+// until the next A4 03. Only the tail of a chunk that may
+// start a frame is copied, into a buffer allocated once at construction.
+class UsbFrameParser {
+public:
+  static constexpr std::size_t kHeaderSize = 21;
+  static constexpr std::size_t kDefaultMaxFrameSize = 4096;
+
+  explicit UsbFrameParser(std::size_t maxFrameSize = kDefaultMaxFrameSize);
+
+  // Calls onFrame(const ReceivedFrame &) for each frame completed by chunk.
+  template <typename OnFrame>
+  void feed(std::span<const uint8_t> chunk, OnFrame &&onFrame) {
+    while (!carry_.empty() && !chunk.empty()) {
+      std::size_t take = std::min(carryWanted() - carry_.size(), chunk.size());
+      carry_.insert(carry_.end(), chunk.begin(), chunk.begin() + take);
+      chunk = chunk.subspan(take);
+      carry_.erase(carry_.begin(),
+                   carry_.begin() + scan(carry_, onFrame));
+    }
+    std::size_t used = scan(chunk, onFrame);
+    carry_.insert(carry_.end(), chunk.begin() + used, chunk.end());
+  }
+
+  const FrameParserStats &stats() const { return stats_; }
+  std::size_t buffered() const { return carry_.size(); }
+  void reset();
+
+private:
+  enum class Header : uint8_t { Incomplete, Bad, Oversized, Ok };
+
+  std::size_t maxFrameSize_;
+  std::vector<uint8_t> carry_;
+  FrameParserStats stats_;
+
+  // Checks the fixed header at the start of data, setting length to the
+  // whole frame's size when it is good.
+  Header checkHeader(std::span<const uint8_t> data, std::size_t &length) const;
+  std::size_t carryWanted() const;
+
+  // Emits the frames in data and returns how many bytes were used; the rest
+  // is a possible frame start that needs more bytes.
+  template <typename OnFrame>
+  std::size_t scan(std::span<const uint8_t> data, OnFrame &onFrame) {
+    std::size_t pos = 0;
+    while (pos < data.size()) {
+      const void *hit = std::memchr(data.data() + pos, 0xA4, data.size() - pos);
+      if (!hit) {
+        stats_.discardedBytes += data.size() - pos;
+        return data.size();
+      }
+      std::size_t at = static_cast<const uint8_t *>(hit) - data.data();
+      stats_.discardedBytes += at - pos;
+      pos = at;
+
+      std::size_t length = 0;
+      switch (checkHeader(data.subspan(pos), length)) {
+      case Header::Incomplete:
+        return pos;
+      case Header::Bad:
+        ++stats_.badHeaders;
+        skipByte(pos);
+        continue;
+      case Header::Oversized:
+        ++stats_.oversized;
+        skipByte(pos);
+        continue;
+      case Header::Ok:
+        break;
+      }
+      if (data.size() - pos < length)
+        return pos;
+
+      std::span<const uint8_t> frame = data.subspan(pos, length);
+      uint32_t sum = sumBytes(frame.subspan(16, length - 17));
+      if (static_cast<uint8_t>(sum) != frame[length - 1]) {
+        ++stats_.badChecksums;
+        skipByte(pos);
+        continue;
+      }
+      ++stats_.frames;
+      onFrame(ReceivedFrame{frame, frame[18],
+                            frame.subspan(kHeaderSize, length - 22)});
+      pos += length;
+    }
+    return pos;
+  }
+
+  void skipByte(std::size_t &pos) {
+    ++stats_.discardedBytes;
+    ++pos;
+  }
+};
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "frame.h"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+// A bounded queue of frames for many producers and one consumer, without
+// locks. Every slot is allocated with the ring and carries a sequence number:
+// a producer claims the next slot by advancing tail with a compare-exchange,
+// moves its frame into the slot and publishes it by bumping the sequence; the
+// consumer takes slots in order and hands them back the same way. Command
+// frames fit Frame's inline storage, so pushing and popping never allocate.
+template <std::size_t N> class FrameRing {
+  static_assert(N >= 2 && (N & (N - 1)) == 0,
+                "FrameRing capacity must be a power of two");
+
+public:
+  static constexpr std::size_t kCapacity = N;
+
+  FrameRing() {
+    for (std::size_t i = 0; i < N; ++i)
+      cells_[i].sequence.store(i, std::memory_order_relaxed);
+  }
+
+  FrameRing(const FrameRing &) = delete;
+  FrameRing &operator=(const FrameRing &) = delete;
+
+  // Safe from any thread. When the ring is full the frame is left untouched
+  // and false is returned.
+  bool tryPush(Frame &frame) {
+    std::size_t pos = tail_.load(std::memory_order_relaxed);
+    while (true) {
+      Cell &cell = cells_[pos & (N - 1)];
+      std::size_t sequence = cell.sequence.load(std::memory_order_acquire);
+      auto lag = static_cast<std::ptrdiff_t>(sequence - pos);
+      if (lag == 0) {
+        if (tail_.compare_exchange_weak(pos, pos + 1,
+                                        std::memory_order_relaxed)) {
+          cell.frame = std::move(frame);
+          cell.sequence.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (lag < 0) {
+        return false;
+      } else {
+        pos = tail_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // Consumer thread only. A slot that was claimed but not yet published ends
+  // the queue until its producer finishes writing it.
+  bool tryPop(Frame &frame) {
+    Cell &cell = cells_[head_ & (N - 1)];
+    if (cell.sequence.load(std::memory_order_acquire) != head_ + 1)
+      return false;
+    frame = std::move(cell.frame);
+    cell.sequence.store(head_ + N, std::memory_order_release);
+    ++head_;
+    return true;
+  }
+
+  // Consumer thread only.
+  bool empty() const {
+    const Cell &cell = cells_[head_ & (N - 1)];
+    return cell.sequence.load(std::memory_order_acquire) != head_ + 1;
+  }
+
+private:
+  struct alignas(64) Cell {
+    std::atomic<std::size_t> sequence{0};
+    Frame frame;
+  };
+
+  std::array<Cell, N> cells_;
+  alignas(64) std::atomic<std::size_t> tail_{0};
+  alignas(64) std::size_t head_ = 0;
+};
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <span>
+
+// An outgoing USB frame. Command frames are 22-30 bytes, so up to
+// kInlineCapacity bytes are stored inline and copying or queueing a frame
+// never touches the heap; larger buffers (firmware upgrade blocks) spill to a
+// heap allocation.
+class Frame {
+public:
+  static constexpr std::size_t kInlineCapacity = 64;
+
+  Frame() = default;
+  explicit Frame(std::size_t size) { resize(size); }
+  explicit Frame(std::span<const uint8_t> bytes) { assign(bytes); }
+
+  Frame(const Frame &other) { assign(other.bytes()); }
+  Frame(Frame &&other) noexcept { take(other); }
+
+  Frame &operator=(const Frame &other) {
+    if (this != &other)
+      assign(other.bytes());
+    return *this;
+  }
+
+  Frame &operator=(Frame &&other) noexcept {
+    if (this != &other)
+      take(other);
+    return *this;
+  }
+
+  uint8_t *data() { return heap_ ? heap_.get() : inline_; }
+  const uint8_t *data() const { return heap_ ? heap_.get() : inline_; }
+  std::size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  bool isInline() const { return !heap_; }
+
+  uint8_t *begin() { return data(); }
+  uint8_t *end() { return data() + size_; }
+  const uint8_t *begin() const { return data(); }
+  const uint8_t *end() const { return data() + size_; }
+
+  uint8_t &operator[](std::size_t i) { return data()[i]; }
+  uint8_t operator[](std::size_t i) const { return data()[i]; }
+  uint8_t back() const { return data()[size_ - 1]; }
+
+  std::span<uint8_t> bytes() { return {data(), size_}; }
+  std::span<const uint8_t> bytes() const { return {data(), size_}; }
+
+  void assign(std::span<const uint8_t> bytes) {
+    size_ = 0;
+    resize(bytes.size());
+    if (!bytes.empty())
+      std::memmove(data(), bytes.data(), bytes.size());
+  }
+
+  // New bytes are zero.
+  void resize(std::size_t size) {
+    if (size > capacity()) {
+      std::size_t capacity = std::max(size, 2 * this->capacity());
+      std::unique_ptr<uint8_t[]> grown(new uint8_t[capacity]);
+      std::memcpy(grown.get(), data(), size_);
+      heap_ = std::move(grown);
+      heapCapacity_ = capacity;
+    }
+    if (size > size_)
+      std::memset(data() + size_, 0, size - size_);
+    size_ = size;
+  }
+
+  void push_back(uint8_t byte) {
+    resize(size_ + 1);
+    data()[size_ - 1] = byte;
+  }
+
+  void clear() { size_ = 0; }
+
+  friend bool operator==(const Frame &a, const Frame &b) {
+    return std::ranges::equal(a.bytes(), b.bytes());
+  }
+
+private:
+  std::size_t size_ = 0;
+  std::size_t heapCapacity_ = 0;
+  std::unique_ptr<uint8_t[]> heap_;
+  uint8_t inline_[kInlineCapacity];
+
+  std::size_t capacity() const {
+    return heap_ ? heapCapacity_ : kInlineCapacity;
+  }
+
+  void take(Frame &other) {
+    size_ = other.size_;
+    heapCapacity_ = other.heapCapacity_;
+    heap_ = std::move(other.heap_);
+    if (!heap_)
+      std::memcpy(inline_, other.inline_, size_);
+    other.size_ = 0;
+    other.heapCapacity_ = 0;
+  }
+};
+
+// A frame assembled around a borrowed payload, such as the data[] of a large
+// array argument: head holds the bytes before the view, tail the bytes after
+// it. The viewed bytes must outlive the frame. libusb wants one buffer per
+// transfer, so gather() is the single copy made on the way to the device.
+struct ScatterFrame {
+  Frame head;
+  std::span<const uint8_t> payload;
+  Frame tail;
+
+  std::size_t size() const {
+    return head.size() + payload.size() + tail.size();
+  }
+
+  std::array<std::span<const uint8_t>, 3> segments() const {
+    return {head.bytes(), payload, tail.bytes()};
+  }
+
+  Frame gather() const {
+    Frame frame(size());
+    uint8_t *out = frame.data();
+    for (std::span<const uint8_t> segment : segments())
+      out = std::copy(segment.begin(), segment.end(), out);
+    return frame;
+  }
+};
@@ -1,10 +1,13 @@
 #include "control-catalogue.h"
 #include "command-database.h"
+#include "frame-parser.h"
+#include "receive-decoder.h"
 #include "usb-send.h"
 #include <algorithm>
 #include <cctype>
 #include <chrono>
 #include <csignal>
+#include <cstdlib>
 #include <cstdio>
 #include <exception>
 #include <filesystem>
@@ -50,7 +53,7 @@ static bool parseU16Value(const string &s, uint16_t &out) {
   }
 }
 
-static void log_packet(const vector<unsigned char> &packet) {
+static void log_packet(span<const unsigned char> packet) {
   printf("[VERBOSE] ");
   for (size_t i = 0; i < packet.size(); ++i) {
     printf("%02X", packet[i]);
@@ -61,7 +64,7 @@ static void log_packet(const vector<unsigned char> &packet) {
   fflush(stdout);
 }
 
-static void log_received(uint16_t pid, const vector<unsigned char> &packet) {
+static void log_received(uint16_t pid, span<const unsigned char> packet) {
   printf("[RECV %04X] ", pid);
   for (size_t i = 0; i < packet.size(); ++i) {
     printf("%02X", packet[i]);
@@ -72,6 +75,16 @@ static void log_received(uint16_t pid, const vector<unsigned char> &packet) {
   fflush(stdout);
 }
 
+static void log_decoded(const sanbot::DecodedEvent &event) {
+  printf("  %.*s (case %d, type %d)", (int)event.className.size(),
+         event.className.data(), event.receiveCaseId, event.commandType);
+  for (const auto &field : event.fields)
+    printf(" %.*s=%d", (int)field.name.size(), field.name.data(),
+           (int)field.value);
+  printf("\n");
+  fflush(stdout);
+}
+
 static bool parseWheelAction(const string &s, uint8_t &out) {
   string k = lowerString(s);
   if (k == "forward")
@@ -214,12 +227,13 @@ static void printUsage(const char *argv0) {
           "  %s examples\n"
           "  %s [--db PATH] [--debug] [--test] commands\n"
           "  %s [--db PATH] describe-command NAME\n"
+          "  %s [--db PATH] write-snapshot [PATH]\n"
           "  %s [--db PATH] [--target head|bottom|both] [--debug] [--test] "
           "send-command NAME key=value...\n"
           "  %s [--test] take-control\n"
           "  %s [--test] listen [seconds]\n"
           "  %s [--debug] [--test] <legacy-command> ...\n",
-          argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0);
+          argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0);
 }
 
 static void printExamples(const char *argv0) {
@@ -238,7 +252,11 @@ static void printExamples(const char *argv0) {
          "mcu-command-database/sanbot_mcu_commands.sqlite.\n");
   printf("  Use commands to list names and describe-command NAME to see "
          "accepted fields.\n");
+  printf("  Builds with an embedded catalogue use it unless --db PATH or "
+         "SANBOT_MCU_COMMAND_DB is given.\n");
   printf("  Override the database with --db PATH or SANBOT_MCU_COMMAND_DB.\n");
+  printf("  write-snapshot caches the compiled catalogue next to the database; "
+         "it is used until the database changes.\n");
   printf("\n");
 
   printf("Locomotion examples:\n");
@@ -400,6 +418,10 @@ int main(int argc, char **argv) {
   }
 
   auto open_database = [&]() {
+    const char *envPath = getenv("SANBOT_MCU_COMMAND_DB");
+    bool explicitPath = !dbPath.empty() || (envPath && *envPath);
+    if (!explicitPath && sanbot::CommandDatabase::hasEmbeddedCatalogue())
+      return sanbot::CommandDatabase(sanbot::EmbeddedCatalogue{});
     return sanbot::CommandDatabase(
         dbPath.empty() ? defaultDatabasePath(argv[0]) : dbPath);
   };
@@ -411,7 +433,7 @@ int main(int argc, char **argv) {
   };
 
   auto send_packet = [&](const vector<uint8_t> &packet) {
-    vector<unsigned char> buf(packet.begin(), packet.end());
+    Frame buf(packet);
     if (!test) {
       SanbotUsbManager *usb = ensure_manager();
       usb->sendToPoint(buf);
@@ -425,11 +447,15 @@ int main(int argc, char **argv) {
   };
 
   auto send_built_command = [&](const sanbot::BuiltCommand &built) -> bool {
-    vector<unsigned char> buf(built.bytes.begin(), built.bytes.end());
+    const Frame &buf = built.bytes;
     if (!test) {
       SanbotUsbManager *usb = ensure_manager();
       if (built.hasRouteTag()) {
-        usb->sendToPoint(buf);
+        if (!usb->sendRouted(buf, *built.routeTag)) {
+          fprintf(stderr, "%s has unknown route tag 0x%02X.\n",
+                  built.canonicalName.c_str(), *built.routeTag);
+          return false;
+        }
       } else if (directTarget == "head") {
         usb->sendToHead(buf);
       } else if (directTarget == "bottom") {
@@ -446,7 +472,7 @@ int main(int argc, char **argv) {
       }
       usb->waitForPendingSends();
     }
-    if (debug) log_packet(buf);
+    if (debug) log_packet(built.wireBytes());
     if (test) {
       printf("[TEST] Skipped USB send\n");
       fflush(stdout);
@@ -496,7 +522,26 @@ int main(int argc, char **argv) {
     signal(SIGTERM, handleSignal);
 
     SanbotUsbManager *usb = ensure_manager();
-    usb->setListener(log_received);
+    UsbFrameParser headFrames;
+    UsbFrameParser bottomFrames;
+    unique_ptr<sanbot::ReceiveDecoder> decoder;
+    try {
+      decoder = make_unique<sanbot::ReceiveDecoder>(
+          dbPath.empty() ? defaultDatabasePath(argv[0]) : dbPath);
+    } catch (const exception &ex) {
+      fprintf(stderr, "sanbot-mcu-bridge: not decoding reports: %s\n",
+              ex.what());
+    }
+    usb->setListener([&](uint16_t pid, span<const uint8_t> data,
+                         chrono::steady_clock::time_point) {
+      UsbFrameParser &parser =
+          pid == SanbotUsbManager::PID_HEAD ? headFrames : bottomFrames;
+      parser.feed(data, [&](const ReceivedFrame &frame) {
+        log_received(pid, frame.bytes);
+        if (decoder)
+          log_decoded(decoder->decode(frame.bytes));
+      });
+    });
     if (!usb->takeControl()) {
       fprintf(stderr, "sanbot-mcu-bridge: no Sanbot USB endpoints claimed\n");
       return 1;
@@ -518,6 +563,17 @@ int main(int argc, char **argv) {
       this_thread::sleep_for(chrono::milliseconds(100));
     }
     usb->stopListener();
+    for (auto [name, parser] : {pair{"head", &headFrames},
+                                pair{"bottom", &bottomFrames}}) {
+      const FrameParserStats &stats = parser->stats();
+      printf("%s: %llu frames, %llu bytes discarded, %llu bad headers, "
+             "%llu oversized, %llu bad checksums\n",
+             name, (unsigned long long)stats.frames,
+             (unsigned long long)stats.discardedBytes,
+             (unsigned long long)stats.badHeaders,
+             (unsigned long long)stats.oversized,
+             (unsigned long long)stats.badChecksums);
+    }
     return 0;
   }
 
@@ -539,6 +595,23 @@ int main(int argc, char **argv) {
       return 0;
     }
 
+    if (cmd == "write-snapshot") {
+      if (argc - argi > 2) {
+        printUsage(argv[0]);
+        return 1;
+      }
+      auto db = sanbot::CommandDatabase(
+          dbPath.empty() ? defaultDatabasePath(argv[0]) : dbPath,
+          sanbot::SnapshotPolicy::Ignore);
+      string snapshotPath = argc - argi == 2
+                                ? string(argv[argi + 1])
+                                : sanbot::CommandDatabase::snapshotPathFor(
+                                      db.path());
+      db.writeSnapshot(snapshotPath);
+      printf("wrote %s\n", snapshotPath.c_str());
+      return 0;
+    }
+
     if (cmd == "send-command" || cmd == "db-send" || cmd == "command") {
       if (argc - argi < 2) {
         printUsage(argv[0]);
@@ -1,105 +1,200 @@
 #include "packet-assembler.h"
 #include <algorithm>
+#include <cstring>
 using namespace std;
 
-array<uint8_t, 2> toBytes16BE(uint16_t value) {
-  uint8_t b0 = (value >> 8) & 0xFF;
-  uint8_t b1 = (value) & 0xFF;
-  return {b0, b1};
-}
-
-array<uint8_t, 4> toBytes32BE(uint32_t value) {
-  uint8_t b0 = (value >> 24) & 0xFF;
-  uint8_t b1 = (value >> 16) & 0xFF;
-  uint8_t b2 = (value >> 8) & 0xFF;
-  uint8_t b3 = value & 0xFF;
-  return {b0, b1, b2, b3};
-}
-
 vector<uint8_t> buildDatas(const CommandPayload &cmd) {
-  vector<int8_t> list;
-  list.reserve(1 + cmd.orderedBytes.size());
-  list.push_back(static_cast<int8_t>(cmd.commandMode));
-
-  for (int8_t sb : cmd.orderedBytes)
-    list.push_back(sb);
-
-  list.erase(remove(list.begin(), list.end(), static_cast<int8_t>(-1)),
-             list.end());
-
   vector<uint8_t> datas;
-  datas.reserve(list.size());
-
-  for (int8_t sb : list)
-    datas.push_back(static_cast<uint8_t>(sb));
-
+  buildDatas(cmd, datas);
   return datas;
 }
 
-UsbComputed computeUsbFieldsAndChecksum(const UsbFrameParams &params,
-                                        const vector<uint8_t> &datas) {
-  UsbComputed out;
-  out.content_len = static_cast<uint32_t>(datas.size() + 5 + 1);
-  out.mmnn = static_cast<uint16_t>(datas.size() + 1);
-  out.msg_size = toBytes32BE(out.content_len);
+// Fills a caller-owned buffer so repeated builds can reuse its capacity.
+void buildDatas(const CommandPayload &cmd, vector<uint8_t> &datas) {
+  datas.clear();
+  datas.reserve(1 + cmd.orderedBytes.size());
+  datas.push_back(cmd.commandMode);
 
-  auto fh = toBytes16BE(params.frame_head);
-  uint32_t data_sum = 0;
-  data_sum += fh[0];
-  data_sum += fh[1];
-  data_sum += params.ack_flg;
-  data_sum += out.mmnn;
-  for (auto b : datas)
-    data_sum += b;
-
-  out.checkSum = static_cast<uint8_t>(data_sum & 0xFF);
-  return out;
+  for (int8_t sb : cmd.orderedBytes)
+    datas.push_back(static_cast<uint8_t>(sb));
+
+  datas.erase(remove(datas.begin(), datas.end(), uint8_t{0xFF}), datas.end());
 }
 
 vector<uint8_t> buildUsbFrame(const UsbFrameParams &params,
-                              const vector<uint8_t> &datas) {
-  UsbComputed computed = computeUsbFieldsAndChecksum(params, datas);
-
-  vector<uint8_t> frame;
-  frame.reserve(params.MSG_HEAD_LEN + computed.content_len);
-  auto t = toBytes16BE(params.type);
-  frame.insert(frame.end(), t.begin(), t.end());
-  auto st = toBytes16BE(params.subtype);
-  frame.insert(frame.end(), st.begin(), st.end());
-  frame.insert(frame.end(), computed.msg_size.begin(), computed.msg_size.end());
-  frame.push_back(params.ack_flg);
-  frame.insert(frame.end(), params.unuse.begin(), params.unuse.end());
-
-  auto fh = toBytes16BE(params.frame_head);
-  frame.insert(frame.end(), fh.begin(), fh.end());
-  frame.push_back(params.ack_flg);
-  auto mmnn = toBytes16BE(computed.mmnn);
-  frame.insert(frame.end(), mmnn.begin(), mmnn.end());
-
-  frame.insert(frame.end(), datas.begin(), datas.end());
-  frame.push_back(computed.checkSum);
-
+                              span<const uint8_t> datas) {
+  vector<uint8_t> frame(FrameWriter::frameSize(datas.size()));
+  FrameWriter(frame).writeUsbFrame(params, datas);
   return frame;
 }
 
+void appendUsbFrame(vector<uint8_t> &frame, const UsbFrameParams &params,
+                    span<const uint8_t> datas) {
+  size_t offset = frame.size();
+  frame.resize(offset + FrameWriter::frameSize(datas.size()));
+  FrameWriter(span<uint8_t>(frame).subspan(offset))
+      .writeUsbFrame(params, datas);
+}
+
 vector<uint8_t> appendPointTagForRouting(const vector<uint8_t> &usbFrame,
                                          uint8_t point_tag) {
-  vector<uint8_t> routed = usbFrame;
+  vector<uint8_t> routed;
+  routed.reserve(usbFrame.size() + 1);
+  routed = usbFrame;
   routed.push_back(point_tag);
   return routed;
 }
 
 vector<uint8_t> assembleUsbFrameFromCommand(const CommandPayload &cmd,
                                             uint8_t ack_flg) {
+  vector<uint8_t> frame(FrameWriter::commandFrameSize(cmd));
+  FrameWriter(frame).writeCommand(cmd, ack_flg);
+  return frame;
+}
+
+vector<uint8_t> assembleRoutedBuffer(const CommandPayload &cmd, uint8_t ack_flg,
+                                     uint8_t point_tag) {
+  vector<uint8_t> frame(FrameWriter::commandFrameSize(cmd) + 1);
+  FrameWriter(frame).writeRoutedCommand(cmd, ack_flg, point_tag);
+  return frame;
+}
+
+ScatterFrame buildScatterFrame(uint8_t ack_flg, span<const uint8_t> prefix,
+                               span<const uint8_t> payload,
+                               span<const uint8_t> suffix) {
   UsbFrameParams params;
   params.ack_flg = ack_flg;
+  ScatterFrame frame;
+  frame.head.resize(FrameWriter::headerSize());
 
-  vector<uint8_t> datas = buildDatas(cmd);
-  return buildUsbFrame(params, datas);
+  uint32_t data_sum = 0;
+  size_t dataLength = 0;
+  auto keep = [&](span<const uint8_t> bytes, Frame &out) {
+    for (uint8_t b : bytes) {
+      if (b == 0xFF)
+        continue;
+      out.push_back(b);
+      data_sum += b;
+      ++dataLength;
+    }
+  };
+
+  keep(prefix, frame.head);
+  if (!payload.empty() && memchr(payload.data(), 0xFF, payload.size())) {
+    keep(payload, frame.head);
+  } else {
+    frame.payload = payload;
+    data_sum += sumBytes(payload);
+    dataLength += payload.size();
+  }
+  keep(suffix, frame.tail);
+
+  FrameWriter(frame.head.bytes()).writeUsbHeader(params, dataLength);
+  auto fh = toBytes16BE(params.frame_head);
+  data_sum += fh[0] + fh[1] + params.ack_flg +
+              static_cast<uint16_t>(dataLength + 1);
+  frame.tail.push_back(static_cast<uint8_t>(data_sum & 0xFF));
+  return frame;
 }
 
-vector<uint8_t> assembleRoutedBuffer(const CommandPayload &cmd, uint8_t ack_flg,
-                                     uint8_t point_tag) {
-  vector<uint8_t> usbFrame = assembleUsbFrameFromCommand(cmd, ack_flg);
-  return appendPointTagForRouting(usbFrame, point_tag);
+FrameStatus validateUsbFrame(span<const uint8_t> frame) {
+  UsbFrameParams params;
+  size_t header = FrameWriter::headerSize();
+  if (frame.size() < header + 1)
+    return FrameStatus::Truncated;
+  auto be16 = [&](size_t at) {
+    return static_cast<uint16_t>(frame[at] << 8 | frame[at + 1]);
+  };
+  size_t head = params.MSG_HEAD_LEN;
+  if (be16(0) != params.type)
+    return FrameStatus::BadType;
+  if (be16(head) != params.frame_head)
+    return FrameStatus::BadHead;
+
+  size_t dataLength = frame.size() - header - 1;
+  uint32_t content_len = static_cast<uint32_t>(be16(4)) << 16 | be16(6);
+  if (content_len != dataLength + 5 + 1 || be16(head + 3) != dataLength + 1)
+    return FrameStatus::BadLength;
+
+  uint32_t data_sum = frame[head] + frame[head + 1] + frame[head + 2] +
+                      be16(head + 3);
+  data_sum += sumBytes(frame.subspan(header, dataLength));
+  if (static_cast<uint8_t>(data_sum & 0xFF) != frame.back())
+    return FrameStatus::BadChecksum;
+  return FrameStatus::Ok;
+}
+
+const char *frameStatusName(FrameStatus status) {
+  switch (status) {
+  case FrameStatus::Ok:
+    return "ok";
+  case FrameStatus::Truncated:
+    return "truncated";
+  case FrameStatus::BadType:
+    return "bad type";
+  case FrameStatus::BadHead:
+    return "bad frame head";
+  case FrameStatus::BadLength:
+    return "bad length";
+  case FrameStatus::BadChecksum:
+    return "bad checksum";
+  }
+  return "unknown";
+}
+
+namespace {
+
+size_t commandDataLength(const CommandPayload &cmd) {
+  size_t length = cmd.commandMode != 0xFF;
+  for (int8_t sb : cmd.orderedBytes)
+    length += sb != -1;
+  return length;
+}
+
+} // namespace
+
+size_t FrameWriter::commandFrameSize(const CommandPayload &cmd) {
+  return frameSize(commandDataLength(cmd));
+}
+
+bool FrameWriter::writeCommand(const CommandPayload &cmd, uint8_t ack_flg) {
+  size_t dataLength = commandDataLength(cmd);
+  size_t length = frameSize(dataLength);
+  if (buffer_.size() - size_ < length)
+    return false;
+
+  UsbFrameParams params;
+  params.ack_flg = ack_flg;
+  UsbComputed computed;
+  computed.content_len = static_cast<uint32_t>(dataLength + 5 + 1);
+  computed.mmnn = static_cast<uint16_t>(dataLength + 1);
+  computed.msg_size = toBytes32BE(computed.content_len);
+  uint8_t *out = writeHeader(params, computed);
+
+  // Same sum as computeUsbFieldsAndChecksum, taken while the payload is
+  // copied instead of from a filtered copy of it.
+  auto fh = toBytes16BE(params.frame_head);
+  uint32_t data_sum = fh[0] + fh[1] + params.ack_flg + computed.mmnn;
+  if (cmd.commandMode != 0xFF) {
+    *out++ = cmd.commandMode;
+    data_sum += cmd.commandMode;
+  }
+  for (int8_t sb : cmd.orderedBytes) {
+    if (sb == -1)
+      continue;
+    *out++ = static_cast<uint8_t>(sb);
+    data_sum += static_cast<uint8_t>(sb);
+  }
+  *out = static_cast<uint8_t>(data_sum & 0xFF);
+  size_ += length;
+  return true;
+}
+
+bool FrameWriter::writeRoutedCommand(const CommandPayload &cmd,
+                                     uint8_t ack_flg, uint8_t point_tag) {
+  if (buffer_.size() - size_ < commandFrameSize(cmd) + 1)
+    return false;
+  writeCommand(cmd, ack_flg);
+  buffer_[size_++] = point_tag;
+  return true;
 }
@@ -1,7 +1,14 @@
 #pragma once
+#include <algorithm>
 #include <array>
+#include <cstddef>
 #include <cstdint>
+#include <span>
+#include <type_traits>
 #include <vector>
+
+#include "byte-sum.h"
+#include "frame.h"
 using namespace std;
 
 struct CommandPayload {
@@ -25,16 +32,171 @@ struct UsbComputed {
   uint8_t checkSum;
 };
 
-array<uint8_t, 2> toBytes16BE(uint16_t value);
-array<uint8_t, 4> toBytes32BE(uint32_t value);
+constexpr array<uint8_t, 2> toBytes16BE(uint16_t value) {
+  uint8_t b0 = (value >> 8) & 0xFF;
+  uint8_t b1 = (value) & 0xFF;
+  return {b0, b1};
+}
+
+constexpr array<uint8_t, 4> toBytes32BE(uint32_t value) {
+  uint8_t b0 = (value >> 24) & 0xFF;
+  uint8_t b1 = (value >> 16) & 0xFF;
+  uint8_t b2 = (value >> 8) & 0xFF;
+  uint8_t b3 = value & 0xFF;
+  return {b0, b1, b2, b3};
+}
+
+constexpr UsbComputed computeUsbFieldsAndChecksum(const UsbFrameParams &params,
+                                                  span<const uint8_t> datas) {
+  UsbComputed out;
+  out.content_len = static_cast<uint32_t>(datas.size() + 5 + 1);
+  out.mmnn = static_cast<uint16_t>(datas.size() + 1);
+  out.msg_size = toBytes32BE(out.content_len);
+
+  auto fh = toBytes16BE(params.frame_head);
+  uint32_t data_sum = 0;
+  data_sum += fh[0];
+  data_sum += fh[1];
+  data_sum += params.ack_flg;
+  data_sum += out.mmnn;
+  if (is_constant_evaluated()) {
+    for (auto b : datas)
+      data_sum += b;
+  } else {
+    data_sum += sumBytes(datas);
+  }
+
+  out.checkSum = static_cast<uint8_t>(data_sum & 0xFF);
+  return out;
+}
+
 vector<uint8_t> buildDatas(const CommandPayload &cmd);
-UsbComputed computeUsbFieldsAndChecksum(const UsbFrameParams &params,
-                                        const vector<uint8_t> &datas);
+void buildDatas(const CommandPayload &cmd, vector<uint8_t> &datas);
 vector<uint8_t> buildUsbFrame(const UsbFrameParams &params,
-                              const vector<uint8_t> &datas);
+                              span<const uint8_t> datas);
+void appendUsbFrame(vector<uint8_t> &out, const UsbFrameParams &params,
+                    span<const uint8_t> datas);
 vector<uint8_t> appendPointTagForRouting(const vector<uint8_t> &usbFrame,
                                          uint8_t point_tag);
 vector<uint8_t> assembleUsbFrameFromCommand(const CommandPayload &cmd,
                                             uint8_t ack_flg);
 vector<uint8_t> assembleRoutedBuffer(const CommandPayload &cmd, uint8_t ack_flg,
                                      uint8_t point_tag);
+
+// The USB frame for the payload prefix + payload + suffix, with payload
+// borrowed rather than copied and its checksum taken over the view. 0xFF
+// bytes are dropped as buildDatas does; a payload containing any is copied,
+// filtered, into head instead.
+ScatterFrame buildScatterFrame(uint8_t ack_flg, span<const uint8_t> prefix,
+                               span<const uint8_t> payload,
+                               span<const uint8_t> suffix);
+
+enum class FrameStatus : uint8_t {
+  Ok,
+  Truncated,
+  BadType,
+  BadHead,
+  BadLength,
+  BadChecksum,
+};
+
+// Checks a USB frame (without route tag) as the assembler lays it out: the
+// A4 03 type, the FF A5 frame head, the size and mmnn fields against the
+// frame length, and the checksum over the payload. The checksum adds mmnn as
+// one 16-bit value, as USBCommand.getMessage does; UsbFrameParser checks
+// received frames byte by byte as ConvertUtils.isComplete does instead, and
+// the two differ once mmnn exceeds 255.
+FrameStatus validateUsbFrame(span<const uint8_t> frame);
+const char *frameStatusName(FrameStatus status);
+
+// Serializes frames straight into a caller-provided buffer: header, payload
+// (0xFF bytes dropped as buildDatas does), checksum and optional route tag in
+// one pass with no heap allocation. Consecutive writes are laid out back to
+// back. A write that does not fit returns false and leaves the writer as it
+// was.
+class FrameWriter {
+public:
+  constexpr explicit FrameWriter(span<uint8_t> buffer) : buffer_(buffer) {}
+
+  static constexpr size_t frameSize(size_t dataLength) {
+    return UsbFrameParams{}.MSG_HEAD_LEN + 5 + dataLength + 1;
+  }
+  static constexpr size_t headerSize() { return frameSize(0) - 1; }
+  static size_t commandFrameSize(const CommandPayload &cmd);
+
+  constexpr bool writeUsbFrame(const UsbFrameParams &params,
+                               span<const uint8_t> datas) {
+    size_t length = frameSize(datas.size());
+    if (buffer_.size() - size_ < length)
+      return false;
+
+    UsbComputed computed = computeUsbFieldsAndChecksum(params, datas);
+    uint8_t *out = writeHeader(params, computed);
+    out = copy(datas.begin(), datas.end(), out);
+    *out = computed.checkSum;
+    size_ += length;
+    return true;
+  }
+  // The header alone, for a frame whose payload and checksum are written
+  // elsewhere.
+  constexpr bool writeUsbHeader(const UsbFrameParams &params,
+                                size_t dataLength) {
+    if (buffer_.size() - size_ < headerSize())
+      return false;
+    UsbComputed computed{};
+    computed.content_len = static_cast<uint32_t>(dataLength + 5 + 1);
+    computed.mmnn = static_cast<uint16_t>(dataLength + 1);
+    computed.msg_size = toBytes32BE(computed.content_len);
+    writeHeader(params, computed);
+    size_ += headerSize();
+    return true;
+  }
+  bool writeCommand(const CommandPayload &cmd, uint8_t ack_flg);
+  bool writeRoutedCommand(const CommandPayload &cmd, uint8_t ack_flg,
+                          uint8_t point_tag);
+
+  constexpr size_t size() const { return size_; }
+  constexpr span<const uint8_t> written() const { return buffer_.first(size_); }
+  constexpr void clear() { size_ = 0; }
+
+private:
+  span<uint8_t> buffer_;
+  size_t size_ = 0;
+
+  constexpr uint8_t *writeHeader(const UsbFrameParams &params,
+                                 const UsbComputed &computed) {
+    uint8_t *out = buffer_.data() + size_;
+    auto put = [&out](const auto &bytes) {
+      out = copy(bytes.begin(), bytes.end(), out);
+    };
+    put(toBytes16BE(params.type));
+    put(toBytes16BE(params.subtype));
+    put(computed.msg_size);
+    *out++ = params.ack_flg;
+    put(params.unuse);
+    put(toBytes16BE(params.frame_head));
+    *out++ = params.ack_flg;
+    put(toBytes16BE(computed.mmnn));
+    return out;
+  }
+};
+
+// Compile-time frames for commands without variable fields. datas is the
+// payload as buildDatas would produce it, so it must not contain 0xFF.
+template <size_t N>
+constexpr array<uint8_t, FrameWriter::frameSize(N)>
+buildUsbFrame(const UsbFrameParams &params, const array<uint8_t, N> &datas) {
+  array<uint8_t, FrameWriter::frameSize(N)> frame{};
+  FrameWriter(frame).writeUsbFrame(params, datas);
+  return frame;
+}
+
+template <size_t N>
+constexpr array<uint8_t, N + 1>
+appendPointTagForRouting(const array<uint8_t, N> &usbFrame,
+                         uint8_t point_tag) {
+  array<uint8_t, N + 1> routed{};
+  copy(usbFrame.begin(), usbFrame.end(), routed.begin());
+  routed[N] = point_tag;
+  return routed;
+}
@@ -0,0 +1,355 @@
+#include "receive-decoder.h"
+
+#include "catalogue-sqlite.h"
+
+#include <algorithm>
+#include <cctype>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+
+namespace sanbot {
+namespace {
+
+constexpr uint32_t kNoCase = std::numeric_limits<uint32_t>::max();
+constexpr std::size_t kPayloadOffset = 21;
+
+std::optional<uint32_t> parseNumber(std::string_view text) {
+  int base = 10;
+  if (text.size() > 2 && text[0] == '0' && (text[1] == 'x' || text[1] == 'X')) {
+    base = 16;
+    text.remove_prefix(2);
+  }
+  if (text.empty())
+    return std::nullopt;
+  uint64_t value = 0;
+  for (char c : text) {
+    int digit = std::isdigit(static_cast<unsigned char>(c))
+                    ? c - '0'
+                    : std::tolower(static_cast<unsigned char>(c)) - 'a' + 10;
+    if (digit < 0 || digit >= base)
+      return std::nullopt;
+    value = value * base + digit;
+    if (value > std::numeric_limits<uint32_t>::max())
+      return std::nullopt;
+  }
+  return static_cast<uint32_t>(value);
+}
+
+// Tokens of a decode_expr: numbers, identifiers, and the punctuation the
+// expressions use ("<<" and ">>" as single tokens).
+class ExprTokens {
+public:
+  explicit ExprTokens(std::string_view text) : text_(text) { advance(); }
+
+  std::string_view peek() const { return token_; }
+
+  std::string_view take() {
+    std::string_view token = token_;
+    advance();
+    return token;
+  }
+
+  bool accept(std::string_view token) {
+    if (token_ != token)
+      return false;
+    advance();
+    return true;
+  }
+
+private:
+  std::string_view text_;
+  std::size_t pos_ = 0;
+  std::string_view token_;
+
+  void advance() {
+    while (pos_ < text_.size() &&
+           std::isspace(static_cast<unsigned char>(text_[pos_])))
+      ++pos_;
+    std::size_t start = pos_;
+    if (pos_ >= text_.size()) {
+      token_ = {};
+      return;
+    }
+    if (std::isalnum(static_cast<unsigned char>(text_[pos_])) ||
+        text_[pos_] == '_') {
+      while (pos_ < text_.size() &&
+             (std::isalnum(static_cast<unsigned char>(text_[pos_])) ||
+              text_[pos_] == '_'))
+        ++pos_;
+    } else if (text_.compare(pos_, 2, "<<") == 0 ||
+               text_.compare(pos_, 2, ">>") == 0) {
+      pos_ += 2;
+    } else {
+      ++pos_;
+    }
+    token_ = text_.substr(start, pos_ - start);
+  }
+};
+
+} // namespace
+
+ReceiveDecoder::ReceiveDecoder(const std::string &dbPath)
+    : ReceiveDecoder(loadSqliteReceiveCases(dbPath)) {}
+
+ReceiveDecoder::ReceiveDecoder(std::vector<ReceiveCaseInfo> cases)
+    : cases_(std::move(cases)) {
+  compile();
+}
+
+// Precedence as in Java: shifts bind tighter than &, and & tighter than |.
+// Operands are emitted before their operator, so the ops come out in postfix
+// order for run().
+void ReceiveDecoder::compileExpr(std::string_view text, CompiledField &field) {
+  ExprTokens tokens(text);
+  auto fail = [&] {
+    throw std::runtime_error("unsupported decode_expr: " + std::string(text));
+  };
+  field.code = static_cast<uint32_t>(code_.size());
+  std::size_t depth = 0;
+  auto push = [&](Op op, uint32_t operand) {
+    if (++depth > kMaxStack)
+      fail();
+    code_.push_back({op, static_cast<int32_t>(operand)});
+  };
+  auto apply = [&](Op op) {
+    --depth;
+    // The right operand of & follows its left one, so a constant preceded by
+    // a load means the left operand is that load alone.
+    std::size_t size = code_.size() - field.code;
+    if (op == Op::And && size >= 2 && code_.back().op == Op::Constant &&
+        code_.back().operand == 0xFF &&
+        code_[code_.size() - 2].op == Op::Load) {
+      code_.pop_back();
+      code_.back().op = Op::LoadUnsigned;
+      return;
+    }
+    code_.push_back({op, 0});
+  };
+
+  auto parseOr = [&](auto &self) -> void {
+    auto primary = [&] {
+      if (tokens.accept("(")) {
+        self(self);
+        if (!tokens.accept(")"))
+          fail();
+        return;
+      }
+      if (tokens.accept("packet")) {
+        if (!tokens.accept("["))
+          fail();
+        std::optional<uint32_t> index = parseNumber(tokens.take());
+        if (!index || *index > std::numeric_limits<int32_t>::max() ||
+            !tokens.accept("]"))
+          fail();
+        field.lastByte = std::max(field.lastByte, *index);
+        push(Op::Load, *index);
+        return;
+      }
+      std::optional<uint32_t> value = parseNumber(tokens.take());
+      if (!value)
+        fail();
+      push(Op::Constant, *value);
+    };
+    auto shift = [&] {
+      primary();
+      while (tokens.peek() == "<<" || tokens.peek() == ">>") {
+        Op op = tokens.take() == "<<" ? Op::ShiftLeft : Op::ShiftRight;
+        primary();
+        apply(op);
+      }
+    };
+    auto bitAnd = [&] {
+      shift();
+      while (tokens.accept("&")) {
+        shift();
+        apply(Op::And);
+      }
+    };
+    bitAnd();
+    while (tokens.accept("|")) {
+      bitAnd();
+      apply(Op::Or);
+    }
+  };
+
+  parseOr(parseOr);
+  if (!tokens.peek().empty())
+    fail();
+  field.codeLength = static_cast<uint32_t>(code_.size()) - field.code;
+}
+
+void ReceiveDecoder::compile() {
+  std::size_t maxFields = 0;
+  unknown_ = kNoCase;
+  for (uint32_t i = 0; i < cases_.size(); ++i) {
+    const ReceiveCaseInfo &info = cases_[i];
+    CompiledCase entry;
+    entry.info = i;
+
+    // "payload starts 0x81 0x09 0x04/0x05"; anything else has no prefix.
+    entry.matchBegin = static_cast<uint32_t>(matches_.size());
+    constexpr std::string_view kStarts = "payload starts ";
+    std::string_view expr = info.matchExpr;
+    if (expr.substr(0, kStarts.size()) == kStarts) {
+      expr.remove_prefix(kStarts.size());
+      while (!expr.empty()) {
+        std::size_t end = std::min(expr.find(' '), expr.size());
+        std::string_view item = expr.substr(0, end);
+        expr.remove_prefix(std::min(end + 1, expr.size()));
+        if (item.empty())
+          continue;
+        MatchByte match;
+        while (!item.empty()) {
+          std::size_t slash = std::min(item.find('/'), item.size());
+          std::optional<uint32_t> value = parseNumber(item.substr(0, slash));
+          if (!value || *value > 0xFF || match.count == match.values.size())
+            throw std::runtime_error("unsupported payload_match_expr: " +
+                                     info.matchExpr);
+          match.values[match.count++] = static_cast<uint8_t>(*value);
+          item.remove_prefix(std::min(slash + 1, item.size()));
+        }
+        matches_.push_back(match);
+        entry.matchCount++;
+      }
+    }
+
+    entry.fieldBegin = static_cast<uint32_t>(fields_.size());
+    for (const ReceiveFieldInfo &field : info.fields) {
+      auto first = fields_.begin() + entry.fieldBegin;
+      if (std::any_of(first, fields_.end(), [&](const CompiledField &seen) {
+            return seen.name == field.fieldName;
+          }))
+        continue;
+      CompiledField compiledField;
+      compiledField.name = field.fieldName;
+      compiledField.isByte = field.fieldType == "B";
+      compileExpr(field.decodeExpr, compiledField);
+      fields_.push_back(compiledField);
+      entry.fieldCount++;
+    }
+    maxFields = std::max<std::size_t>(maxFields, entry.fieldCount);
+
+    if (info.primaryByteHex.empty()) {
+      if (unknown_ == kNoCase)
+        unknown_ = i;
+    } else {
+      std::optional<uint32_t> primary = parseNumber(info.primaryByteHex);
+      if (!primary || *primary > 0xFF)
+        throw std::runtime_error("invalid primary byte: " +
+                                 info.primaryByteHex);
+      dispatch_[*primary].push_back(i);
+    }
+    compiled_.push_back(entry);
+  }
+
+  for (auto &candidates : dispatch_)
+    std::stable_sort(candidates.begin(), candidates.end(),
+                     [&](uint32_t a, uint32_t b) {
+                       if (compiled_[a].matchCount != compiled_[b].matchCount)
+                         return compiled_[a].matchCount >
+                                compiled_[b].matchCount;
+                       return cases_[a].receiveCaseId <
+                              cases_[b].receiveCaseId;
+                     });
+  scratch_.resize(maxFields);
+}
+
+bool ReceiveDecoder::matches(const CompiledCase &entry,
+                             std::span<const uint8_t> payload) const {
+  if (payload.size() < entry.matchCount)
+    return false;
+  for (uint32_t i = 0; i < entry.matchCount; ++i) {
+    const MatchByte &match = matches_[entry.matchBegin + i];
+    auto end = match.values.begin() + match.count;
+    if (std::find(match.values.begin(), end, payload[i]) == end)
+      return false;
+  }
+  return true;
+}
+
+int32_t ReceiveDecoder::run(const CompiledField &field,
+                            const uint8_t *packet) const {
+  const Instruction *op = code_.data() + field.code;
+  // Most fields are a single byte load.
+  if (field.codeLength == 1 && op->op == Op::Load)
+    return static_cast<int8_t>(packet[op->operand]);
+
+  std::array<int32_t, kMaxStack> stack;
+  std::size_t top = 0;
+  for (const Instruction *end = op + field.codeLength; op != end; ++op) {
+    switch (op->op) {
+    case Op::Constant:
+      stack[top++] = op->operand;
+      break;
+    case Op::Load:
+      stack[top++] = static_cast<int8_t>(packet[op->operand]);
+      break;
+    case Op::LoadUnsigned:
+      stack[top++] = packet[op->operand];
+      break;
+    case Op::And:
+      --top;
+      stack[top - 1] &= stack[top];
+      break;
+    case Op::Or:
+      --top;
+      stack[top - 1] |= stack[top];
+      break;
+    case Op::ShiftLeft:
+      --top;
+      stack[top - 1] = static_cast<int32_t>(
+          static_cast<uint32_t>(stack[top - 1]) << (stack[top] & 31));
+      break;
+    case Op::ShiftRight:
+      --top;
+      stack[top - 1] >>= stack[top] & 31;
+      break;
+    }
+  }
+  return stack[0];
+}
+
+const DecodedEvent &ReceiveDecoder::decode(std::span<const uint8_t> frame) {
+  std::span<const uint8_t> payload;
+  if (frame.size() > kPayloadOffset)
+    payload = frame.subspan(kPayloadOffset, frame.size() - kPayloadOffset - 1);
+
+  uint32_t hit = kNoCase;
+  if (!payload.empty()) {
+    for (uint32_t candidate : dispatch_[payload[0]]) {
+      if (matches(compiled_[candidate], payload)) {
+        hit = candidate;
+        break;
+      }
+    }
+  }
+  event_ = DecodedEvent{};
+  if (hit == kNoCase)
+    hit = unknown_;
+  if (hit == kNoCase)
+    return event_;
+
+  const CompiledCase &entry = compiled_[hit];
+  const ReceiveCaseInfo &info = cases_[entry.info];
+  event_.receiveCaseId = info.receiveCaseId;
+  event_.className = info.className;
+  event_.primaryLabel = info.primaryLabel;
+  event_.commandType = info.commandType;
+  event_.known = hit != unknown_;
+
+  std::size_t count = 0;
+  for (uint32_t i = 0; i < entry.fieldCount; ++i) {
+    const CompiledField &field = fields_[entry.fieldBegin + i];
+    // The checksum is not part of any field.
+    if (std::size_t{field.lastByte} + 1 >= frame.size())
+      continue;
+    int32_t value = run(field, frame.data());
+    scratch_[count++] = {field.name,
+                         field.isByte ? static_cast<int8_t>(value) : value};
+  }
+  event_.fields = std::span<const DecodedField>(scratch_.data(), count);
+  return event_;
+}
+
+} // namespace sanbot
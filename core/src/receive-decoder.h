@@ -0,0 +1,133 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace sanbot {
+
+struct ReceiveFieldInfo {
+  int payloadOffset = 0;
+  std::string fieldName;
+  std::string fieldType;
+  std::string decodeExpr;
+};
+
+// One row of mcu_receive_cases with its primary switch entry and fields.
+struct ReceiveCaseInfo {
+  int receiveCaseId = 0;
+  std::string primaryByteHex;
+  std::string primaryLabel;
+  std::string className;
+  int commandType = 0;
+  std::string matchExpr;
+  std::vector<ReceiveFieldInfo> fields;
+};
+
+struct DecodedField {
+  std::string_view name;
+  int32_t value = 0;
+};
+
+// The views point into the decoder and the span into its scratch space; both
+// stay valid until the next decode call.
+struct DecodedEvent {
+  int receiveCaseId = 0;
+  std::string_view className;
+  std::string_view primaryLabel;
+  int commandType = 0;
+  bool known = false;
+  std::span<const DecodedField> fields;
+};
+
+// Decodes incoming MCU frames the way DecodeCommand does, from the receive
+// tables of the catalogue. Everything textual is compiled when the decoder is
+// built: a 256-entry table on payload[0] (receive_primary_switch) selects the
+// candidate cases, the one whose payload_match_expr prefix is longest wins
+// (ties to the lowest case id), and each decode_expr is compiled to a short
+// run of stack-machine ops evaluated with Java byte semantics, so B fields
+// are signed. A payload that matches nothing decodes as the unknown default
+// case. Fields whose bytes lie past the payload are left out; where a case
+// lists a field name more than once (one entry per Java branch) the first is
+// used.
+class ReceiveDecoder {
+public:
+  explicit ReceiveDecoder(const std::string &dbPath);
+  explicit ReceiveDecoder(std::vector<ReceiveCaseInfo> cases);
+
+  ReceiveDecoder(const ReceiveDecoder &) = delete;
+  ReceiveDecoder &operator=(const ReceiveDecoder &) = delete;
+  ReceiveDecoder(ReceiveDecoder &&) = default;
+  ReceiveDecoder &operator=(ReceiveDecoder &&) = default;
+
+  const std::vector<ReceiveCaseInfo> &cases() const { return cases_; }
+
+  // frame is a whole USB frame as UsbFrameParser yields it.
+  const DecodedEvent &decode(std::span<const uint8_t> frame);
+
+private:
+  static constexpr std::size_t kMaxStack = 8;
+
+  // Load pushes packet[operand] as a signed Java byte; LoadUnsigned is the
+  // fused form of (packet[operand] & 0xFF).
+  enum class Op : uint8_t {
+    Constant,
+    Load,
+    LoadUnsigned,
+    And,
+    Or,
+    ShiftLeft,
+    ShiftRight
+  };
+
+  struct Instruction {
+    Op op = Op::Constant;
+    int32_t operand = 0;
+  };
+
+  // One position of a match prefix: up to four accepted bytes.
+  struct MatchByte {
+    std::array<uint8_t, 4> values{};
+    uint8_t count = 0;
+  };
+
+  // The field is decoded when the frame holds packet[lastByte] ahead of the
+  // checksum; the ops themselves do no bounds checks.
+  struct CompiledField {
+    std::string_view name;
+    uint32_t code = 0;
+    uint32_t codeLength = 0;
+    uint32_t lastByte = 0;
+    bool isByte = false;
+  };
+
+  struct CompiledCase {
+    uint32_t info = 0;
+    uint32_t matchBegin = 0;
+    uint32_t matchCount = 0;
+    uint32_t fieldBegin = 0;
+    uint32_t fieldCount = 0;
+  };
+
+  std::vector<ReceiveCaseInfo> cases_;
+  std::vector<CompiledCase> compiled_;
+  std::vector<MatchByte> matches_;
+  std::vector<CompiledField> fields_;
+  std::vector<Instruction> code_;
+  // Candidate cases per primary byte, best match first.
+  std::array<std::vector<uint32_t>, 256> dispatch_;
+  uint32_t unknown_ = 0;
+  std::vector<DecodedField> scratch_;
+  DecodedEvent event_;
+
+  void compile();
+  void compileExpr(std::string_view text, CompiledField &field);
+  bool matches(const CompiledCase &entry,
+               std::span<const uint8_t> payload) const;
+  int32_t run(const CompiledField &field, const uint8_t *packet) const;
+};
+
+} // namespace sanbot
@@ -3,10 +3,11 @@
 #include <chrono>
 #include <cstdio>
 #include <thread>
+#include <utility>
 #include <vector>
 using namespace std;
 
-static void log_packet(const vector<unsigned char> &packet) {
+static void log_packet(span<const unsigned char> packet) {
   for (size_t i = 0; i < packet.size(); ++i) {
     printf("%02X", packet[i]);
     if (i + 1 != packet.size())
@@ -23,10 +24,10 @@ int main(int argc, char **argv) {
   SanbotUsbManager manager;
 
   auto send_packet = [&](const vector<uint8_t> &packet) {
-    vector<unsigned char> buf(packet.begin(), packet.end());
+    Frame buf(packet);
     if (debug)
       log_packet(buf);
-    manager.sendToPoint(buf);
+    manager.sendToPoint(std::move(buf));
     manager.waitForPendingSends();
   };
 
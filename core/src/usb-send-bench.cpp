@@ -0,0 +1,139 @@
+#include "packet-assembler.h"
+#include "usb-send.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <span>
+#include <thread>
+#include <vector>
+
+// Benchmarks SanbotUsbManager against the real MCUs, so both must be attached.
+// Every frame sent is a QueryMCUVersion request, which only makes the MCU
+// report its firmware version.
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double millisecondsSince(Clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(Clock::now() - start)
+      .count();
+}
+
+Frame versionQuery() {
+  return Frame(
+      buildUsbFrame(UsbFrameParams{0x01}, std::array<uint8_t, 2>{0x81, 0x0D}));
+}
+
+// Sends frames to one device and then to the other, then the same frames
+// interleaved. With independent lanes the interleaved run takes about as long
+// as the slower device alone rather than the sum of both.
+void benchLanes(SanbotUsbManager &usb, std::size_t frames) {
+  Frame query = versionQuery();
+
+  auto start = Clock::now();
+  for (std::size_t i = 0; i < frames; ++i)
+    usb.sendToHead(query);
+  usb.waitForPendingSends();
+  double headOnly = millisecondsSince(start);
+
+  start = Clock::now();
+  for (std::size_t i = 0; i < frames; ++i)
+    usb.sendToBottom(query);
+  usb.waitForPendingSends();
+  double bottomOnly = millisecondsSince(start);
+
+  start = Clock::now();
+  for (std::size_t i = 0; i < frames; ++i) {
+    usb.sendToHead(query);
+    usb.sendToBottom(query);
+  }
+  usb.waitForPendingSends(SanbotUsbManager::PID_HEAD);
+  double headDone = millisecondsSince(start);
+  usb.waitForPendingSends(SanbotUsbManager::PID_BOTTOM);
+  double interleaved = millisecondsSince(start);
+
+  std::printf("lanes: %zu frames each, head %.1f ms, bottom %.1f ms, "
+              "interleaved %.1f ms (head done at %.1f ms), overlap %.2fx\n",
+              frames, headOnly, bottomOnly, interleaved, headDone,
+              (headOnly + bottomOnly) / (interleaved > 0 ? interleaved : 1));
+}
+
+// Round trip of single head frames (send, then wait for its completion) with
+// no listener, with a listener, and with one that takes 5 ms per read. The MCU
+// answers each query, so the listener is busy while later frames are sent;
+// since reads are handed to the listener thread, its speed should not show
+// in the send latency. Delivery is the time from a read completing to the
+// listener seeing it; a slow listener runs the buffer pool dry and reads are
+// dropped.
+void benchListenerLatency(SanbotUsbManager &usb, std::size_t frames) {
+  struct Mode {
+    const char *name;
+    bool listen;
+    int delayMs;
+  };
+  Frame query = versionQuery();
+  for (const Mode &mode : {Mode{"no listener", false, 0},
+                           Mode{"listener", true, 0},
+                           Mode{"slow listener", true, 5}}) {
+    std::atomic<std::size_t> reads{0};
+    std::atomic<long long> deliveryUs{0};
+    usb.setListener([&](uint16_t, std::span<const uint8_t>,
+                        Clock::time_point receivedAt) {
+      ++reads;
+      deliveryUs += std::chrono::duration_cast<std::chrono::microseconds>(
+                        Clock::now() - receivedAt)
+                        .count();
+      if (mode.delayMs > 0)
+        std::this_thread::sleep_for(std::chrono::milliseconds(mode.delayMs));
+    });
+    if (mode.listen)
+      usb.startListener();
+
+    double total = 0;
+    double worst = 0;
+    for (std::size_t i = 0; i < frames; ++i) {
+      auto start = Clock::now();
+      usb.sendToHead(query);
+      usb.waitForPendingSends(SanbotUsbManager::PID_HEAD);
+      double elapsed = millisecondsSince(start) * 1000.0;
+      total += elapsed;
+      worst = std::max(worst, elapsed);
+    }
+    usb.stopListener();
+    std::size_t delivered = reads.load();
+    std::printf("send latency, %s: mean %.0f us, max %.0f us (%zu reads, "
+                "delivery %.0f us, %zu dropped so far)\n",
+                mode.name, total / static_cast<double>(frames ? frames : 1),
+                worst, delivered,
+                static_cast<double>(deliveryUs.load()) /
+                    static_cast<double>(delivered ? delivered : 1),
+                usb.droppedReads());
+  }
+  usb.setListener(nullptr);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  try {
+    std::size_t frames = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 500;
+
+    SanbotUsbManager usb;
+    if (!usb.takeControl()) {
+      std::fprintf(stderr, "usb send bench: no Sanbot USB endpoints claimed\n");
+      return 1;
+    }
+    benchLanes(usb, frames);
+    benchListenerLatency(usb, frames);
+    return 0;
+  } catch (const std::exception &ex) {
+    std::fprintf(stderr, "usb send bench failed: %s\n", ex.what());
+    return 1;
+  }
+}
@@ -5,238 +5,519 @@
 #else
 #include <libusb-1.0/libusb.h>
 #endif
-#include <chrono>
+#include <algorithm>
+#include <functional>
 #include <stdexcept>
-#include <thread>
 #include <utility>
 using namespace std;
 
 SanbotUsbManager::SanbotUsbManager() {
-    if (libusb_init(&ctx) != 0) {
-        throw runtime_error("libusb_init failed");
+    for (ReceiveBuffer& buffer : receiveBuffers) {
+        spareBuffers[spareCount++] = &buffer;
+    }
+    try {
+        initLane(head, PID_HEAD);
+        initLane(bottom, PID_BOTTOM);
+    } catch (...) {
+        freeLane(head);
+        freeLane(bottom);
+        throw;
     }
     running = true;
-    worker = thread(&SanbotUsbManager::sendLoop, this);
+    head.eventWorker = thread(&SanbotUsbManager::eventLoop, this, ref(head));
+    bottom.eventWorker = thread(&SanbotUsbManager::eventLoop, this, ref(bottom));
 }
 
 SanbotUsbManager::~SanbotUsbManager() {
     stopListener();
     running = false;
-    cv.notify_all();
-    queueEmptyCv.notify_all();
-    if (worker.joinable()) worker.join();
-    lock_guard<mutex> lock(usbMtx);
-    closeDevice(bottom);
-    closeDevice(head);
-    libusb_exit(ctx);
+    for (EndpointSet* dev : {&head, &bottom}) {
+        wakeEvents(*dev);
+        if (dev->eventWorker.joinable()) dev->eventWorker.join();
+        lock_guard<mutex> lock(dev->mtx);
+        closeDevice(*dev);
+    }
+    freeLane(bottom);
+    freeLane(head);
+}
+
+void SanbotUsbManager::initLane(EndpointSet& dev, uint16_t pid) {
+    dev.owner = this;
+    dev.pid = pid;
+    if (libusb_init(&dev.ctx) != 0) {
+        dev.ctx = nullptr;
+        throw runtime_error("libusb_init failed");
+    }
+    for (OutTransfer& slot : dev.out) {
+        slot.dev = &dev;
+        slot.transfer = libusb_alloc_transfer(0);
+        if (!slot.transfer) throw runtime_error("libusb_alloc_transfer failed");
+    }
+    for (InTransfer& slot : dev.in) {
+        slot.dev = &dev;
+        slot.buffer = spareBuffers[--spareCount];
+        slot.transfer = libusb_alloc_transfer(0);
+        if (!slot.transfer) throw runtime_error("libusb_alloc_transfer failed");
+    }
 }
 
-void SanbotUsbManager::sendToHead(const vector<unsigned char>& frame) {
-    enqueueMessage(WHAT_SEND_TO_HEAD, frame);
+void SanbotUsbManager::freeLane(EndpointSet& dev) {
+    for (OutTransfer& slot : dev.out) {
+        if (slot.transfer) libusb_free_transfer(slot.transfer);
+        slot.transfer = nullptr;
+    }
+    for (InTransfer& slot : dev.in) {
+        if (slot.transfer) libusb_free_transfer(slot.transfer);
+        slot.transfer = nullptr;
+    }
+    if (dev.ctx) libusb_exit(dev.ctx);
+    dev.ctx = nullptr;
 }
 
-void SanbotUsbManager::sendToBottom(const vector<unsigned char>& frame) {
-    enqueueMessage(WHAT_SEND_TO_BOTTOM, frame);
+void SanbotUsbManager::sendToHead(Frame frame) {
+    enqueueMessage(WHAT_SEND_TO_HEAD, std::move(frame));
 }
 
-void SanbotUsbManager::sendToPoint(const vector<unsigned char>& routedFrameWithTag) {
-    enqueueMessage(WHAT_SEND_TO_POINT, routedFrameWithTag);
+void SanbotUsbManager::sendToBottom(Frame frame) {
+    enqueueMessage(WHAT_SEND_TO_BOTTOM, std::move(frame));
 }
 
-void SanbotUsbManager::enqueueMessage(int what, const vector<unsigned char>& data) {
-    lock_guard<mutex> lock(mtx);
-    msgQueue.push(Message{what, data});
-    cv.notify_one();
+bool SanbotUsbManager::sendRouted(Frame frame, uint8_t routeTag) {
+    switch (routeTag) {
+        case 0x01:
+            enqueueMessage(WHAT_SEND_TO_HEAD, std::move(frame));
+            return true;
+        case 0x02:
+            enqueueMessage(WHAT_SEND_TO_BOTTOM, std::move(frame));
+            return true;
+        case 0x03:
+            enqueueMessage(WHAT_SEND_TO_BOTH, std::move(frame));
+            return true;
+        default:
+            return false;
+    }
+}
+
+void SanbotUsbManager::sendToPoint(Frame routedFrameWithTag) {
+    if (routedFrameWithTag.size() < 2) return;
+    uint8_t tag = routedFrameWithTag.back();
+    routedFrameWithTag.resize(routedFrameWithTag.size() - 1);
+    sendRouted(std::move(routedFrameWithTag), tag);
+}
+
+void SanbotUsbManager::enqueueMessage(int what, Frame data) {
+    switch (what) {
+        case WHAT_SEND_TO_HEAD:
+            queueFrame(head, std::move(data));
+            break;
+        case WHAT_SEND_TO_BOTTOM:
+            queueFrame(bottom, std::move(data));
+            break;
+        case WHAT_SEND_TO_BOTH:
+            queueFrame(head, data);
+            queueFrame(bottom, std::move(data));
+            break;
+        default:
+            break;
+    }
+}
+
+// The frame is counted before it is pushed so that the event thread never
+// finishes a frame it has not been told about. A full ring means the device is
+// not keeping up: the sender makes sure the event thread is awake once, then
+// sleeps until it pops a frame. freedSlots is read before each attempt, so a
+// pop in between ends the wait at once.
+void SanbotUsbManager::queueFrame(EndpointSet& dev, Frame data) {
+    if (data.empty()) return;
+    dev.activeMessages.fetch_add(1);
+    if (!dev.pending.tryPush(data)) {
+        wakeEvents(dev);
+        while (true) {
+            uint32_t freed = dev.freedSlots.load();
+            if (dev.pending.tryPush(data)) break;
+            dev.freedSlots.wait(freed);
+        }
+    }
+    if (dev.parked.exchange(false)) wakeEvents(dev);
 }
 
 bool SanbotUsbManager::takeControl() {
-    lock_guard<mutex> lock(usbMtx);
-    openDevice(head, PID_HEAD);
-    openDevice(bottom, PID_BOTTOM);
-    return (head.handle && head.outEp != 0) || (bottom.handle && bottom.outEp != 0);
+    bool claimed = false;
+    for (EndpointSet* dev : {&head, &bottom}) {
+        lock_guard<mutex> lock(dev->mtx);
+        if (!dev->handle) openDevice(*dev);
+        claimed = claimed || (dev->handle && dev->outEp != 0);
+    }
+    return claimed;
 }
 
 void SanbotUsbManager::setListener(UsbListener callback) {
     lock_guard<mutex> lock(listenerMtx);
     listener = std::move(callback);
+    listenerGeneration++;
 }
 
 void SanbotUsbManager::startListener() {
     if (listening.exchange(true)) return;
-    listenerWorker = thread(&SanbotUsbManager::listenLoop, this);
+    // Restarted from a listener call, the running thread carries on once the
+    // call returns; otherwise a thread left by a stop from a listener call is
+    // joined before the new one starts.
+    bool onListenerThread = listenerWorker.get_id() == this_thread::get_id();
+    if (!onListenerThread && listenerWorker.joinable()) listenerWorker.join();
+    {
+        lock_guard<mutex> lock(receivedMtx);
+        delivering = true;
+    }
+    if (!onListenerThread) listenerWorker = thread(&SanbotUsbManager::listenLoop, this);
+    for (EndpointSet* dev : {&head, &bottom}) {
+        lock_guard<mutex> lock(dev->mtx);
+        submitReceives(*dev);
+        wakeEvents(*dev);
+    }
 }
 
+// The listener thread cannot join itself: called from a listener call, this
+// only stops delivery, and the thread ends once the call returns. It is joined
+// by the next startListener or stopListener, or by the destructor.
 void SanbotUsbManager::stopListener() {
-    if (!listening.exchange(false)) return;
+    if (listening.exchange(false)) {
+        stopReceiving(head);
+        stopReceiving(bottom);
+        {
+            lock_guard<mutex> lock(receivedMtx);
+            delivering = false;
+            for (; receivedCount > 0; receivedCount--) {
+                releaseBuffer(received[receivedHead]);
+                receivedHead = (receivedHead + 1) % RECEIVE_BUFFERS;
+            }
+        }
+        receivedCv.notify_all();
+    }
+    if (listenerWorker.get_id() == this_thread::get_id()) return;
     if (listenerWorker.joinable()) listenerWorker.join();
 }
 
-void SanbotUsbManager::sendLoop() {
+void SanbotUsbManager::stopReceiving(EndpointSet& dev) {
+    unique_lock<mutex> lock(dev.mtx);
+    cancelTransfers(dev, false, true);
+    dev.transferCv.wait(lock, [&] {
+        return none_of(dev.in.begin(), dev.in.end(),
+                       [](const InTransfer& slot) { return slot.busy; });
+    });
+}
+
+// The queued buffer's reference passes to the listener call and is released
+// after it, unless the listener retained the buffer too.
+void SanbotUsbManager::listenLoop() {
+    UsbListener callback;
+    uint64_t generation = 0;
+    {
+        lock_guard<mutex> listenerLock(listenerMtx);
+        callback = listener;
+        generation = listenerGeneration;
+    }
+
+    unique_lock<mutex> lock(receivedMtx);
     while (true) {
-        Message msg;
-        {
-            unique_lock<mutex> lock(mtx);
-            cv.wait(lock, [&] { return !msgQueue.empty() || !running; });
-            if (msgQueue.empty() && !running) break;
-            if (msgQueue.empty()) continue;
-            msg = msgQueue.front();
-            msgQueue.pop();
-            activeMessages++;
+        receivedCv.wait(lock, [&] { return receivedCount > 0 || !delivering; });
+        if (!delivering) break;
+        ReceiveBuffer* next = received[receivedHead];
+        receivedHead = (receivedHead + 1) % RECEIVE_BUFFERS;
+        receivedCount--;
+        lock.unlock();
+
+        if (listenerGeneration != generation) {
+            lock_guard<mutex> listenerLock(listenerMtx);
+            callback = listener;
+            generation = listenerGeneration;
         }
-
-        switch (msg.what) {
-            case WHAT_SEND_TO_HEAD:
-                sendBufferTo(head, PID_HEAD, msg.data);
-                break;
-            case WHAT_SEND_TO_BOTTOM:
-                sendBufferTo(bottom, PID_BOTTOM, msg.data);
-                break;
-            case WHAT_SEND_TO_POINT:
-                handlePointMessage(msg.data);
-                break;
-            default:
-                break;
+        if (callback) {
+            callback(next->pid, span<const uint8_t>(next->bytes.data(), next->size),
+                     next->receivedAt);
         }
+        lock.lock();
+        releaseBuffer(next);
+    }
+}
 
+// Senders interrupt the wait only while parked is set. The ring is checked
+// again after setting it, so a frame pushed just before is picked up here
+// rather than waiting for the timeout.
+void SanbotUsbManager::eventLoop(EndpointSet& dev) {
+    while (true) {
         {
-            lock_guard<mutex> lock(mtx);
-            if (activeMessages > 0) activeMessages--;
-            if (msgQueue.empty() && activeMessages == 0) notifyIdle();
+            lock_guard<mutex> lock(dev.mtx);
+            if (!running && dev.pending.empty() && dev.inFlight == 0) break;
+            serviceDevice(dev);
+            dev.parked.store(true);
+            if (canSubmit(dev)) {
+                dev.parked.store(false);
+                continue;
+            }
         }
+        timeval timeout{0, 100000};
+        libusb_handle_events_timeout_completed(dev.ctx, &timeout, nullptr);
+        dev.parked.store(false);
     }
 }
 
-void SanbotUsbManager::handlePointMessage(const vector<unsigned char>& buffers) {
-    if (buffers.size() < 2) return;
-    unsigned char tag = buffers.back();
-    vector<unsigned char> temp(buffers.begin(), buffers.end() - 1);
-
-    switch (tag) {
-        case 0x01:
-            sendBufferTo(head, PID_HEAD, temp);
-            break;
-        case 0x02:
-            sendBufferTo(bottom, PID_BOTTOM, temp);
-            break;
-        case 0x03:
-            sendBufferTo(head, PID_HEAD, temp);
-            sendBufferTo(bottom, PID_BOTTOM, temp);
-            break;
-        default:
-            break;
+// Reopens a failing device once its cancelled transfers have come back, opens
+// one that has work, and drops the frames of one that cannot be opened.
+void SanbotUsbManager::serviceDevice(EndpointSet& dev) {
+    if (dev.reopen) {
+        if (dev.inFlight > 0) return;
+        closeDevice(dev);
     }
-}
-
-void SanbotUsbManager::sendBufferTo(EndpointSet& dev, uint16_t pid, const vector<unsigned char>& buf) {
-    if (buf.empty()) return;
-
-    lock_guard<mutex> lock(usbMtx);
-    if (!dev.handle || dev.outEp == 0) {
-        openDevice(dev, pid);
+    if (!dev.handle && (!dev.pending.empty() || listening)) {
+        openDevice(dev);
     }
-
     if (!dev.handle || dev.outEp == 0) {
-        dev.failCount++;
-        if (dev.failCount % 10 == 0) {
-            closeDevice(dev);
-            openDevice(dev, pid);
+        Frame dropped;
+        while (popFrame(dev, dropped)) {
+            dev.failCount++;
+            finishMessage(dev);
         }
         return;
     }
+    submitPending(dev);
+    submitReceives(dev);
+}
 
-    int transferred = 0;
-    int r = libusb_bulk_transfer(
-        dev.handle,
-        dev.outEp,
-        const_cast<unsigned char*>(buf.data()),
-        (int)buf.size(),
-        &transferred,
-        0
-    );
-
-    if (r < 0 || transferred <= 0) {
-        dev.failCount++;
-        if (dev.failCount % 10 == 0) {
-            closeDevice(dev);
-            openDevice(dev, pid);
+void SanbotUsbManager::submitPending(EndpointSet& dev) {
+    if (!dev.handle || dev.outEp == 0 || dev.reopen) return;
+    size_t next = 0;
+    while (true) {
+        while (next < dev.out.size() && dev.out[next].busy) ++next;
+        if (next == dev.out.size()) return;
+
+        OutTransfer& slot = dev.out[next];
+        if (!popFrame(dev, slot.data)) return;
+        libusb_fill_bulk_transfer(
+            slot.transfer,
+            dev.handle,
+            dev.outEp,
+            slot.data.data(),
+            static_cast<int>(slot.data.size()),
+            outTransferDone,
+            &slot,
+            OUT_TIMEOUT_MS
+        );
+        if (libusb_submit_transfer(slot.transfer) != 0) {
+            recordFailure(dev);
+            finishMessage(dev);
+            if (dev.reopen) return;
+            continue;
         }
-    } else {
-        dev.failCount = 0;
+        slot.busy = true;
+        dev.inFlight++;
     }
 }
 
-void SanbotUsbManager::listenLoop() {
-    while (listening) {
-        bool received = false;
-        {
-            lock_guard<mutex> lock(usbMtx);
-            received = pollEndpoint(head, PID_HEAD) || received;
-            received = pollEndpoint(bottom, PID_BOTTOM) || received;
-        }
-        if (!received) {
-            this_thread::sleep_for(chrono::milliseconds(5));
+// Event thread only.
+bool SanbotUsbManager::popFrame(EndpointSet& dev, Frame& frame) {
+    if (!dev.pending.tryPop(frame)) return false;
+    dev.freedSlots.fetch_add(1);
+    dev.freedSlots.notify_all();
+    return true;
+}
+
+// Whether a queued frame could go out now; event thread only. With the device
+// closed the frame is opened for or dropped, so that counts too.
+bool SanbotUsbManager::canSubmit(const EndpointSet& dev) const {
+    if (dev.pending.empty() || dev.reopen) return false;
+    return !dev.handle || any_of(dev.out.begin(), dev.out.end(),
+                                 [](const OutTransfer& slot) { return !slot.busy; });
+}
+
+void SanbotUsbManager::submitReceives(EndpointSet& dev) {
+    if (!listening || !dev.handle || dev.inEp == 0 || dev.reopen) return;
+    for (InTransfer& slot : dev.in) {
+        if (slot.busy) continue;
+        libusb_fill_bulk_transfer(
+            slot.transfer,
+            dev.handle,
+            dev.inEp,
+            slot.buffer->bytes.data(),
+            static_cast<int>(slot.buffer->bytes.size()),
+            inTransferDone,
+            &slot,
+            0
+        );
+        if (libusb_submit_transfer(slot.transfer) != 0) {
+            recordFailure(dev);
+            return;
         }
+        slot.busy = true;
+        dev.inFlight++;
     }
 }
 
-bool SanbotUsbManager::pollEndpoint(EndpointSet& dev, uint16_t pid) {
-    if (!dev.handle || dev.inEp == 0) {
-        openDevice(dev, pid);
+void SanbotUsbManager::cancelTransfers(EndpointSet& dev, bool outgoing, bool incoming) {
+    if (outgoing) {
+        for (OutTransfer& slot : dev.out) {
+            if (slot.busy) libusb_cancel_transfer(slot.transfer);
+        }
     }
-    if (!dev.handle || dev.inEp == 0) {
-        return false;
+    if (incoming) {
+        for (InTransfer& slot : dev.in) {
+            if (slot.busy) libusb_cancel_transfer(slot.transfer);
+        }
     }
+}
+
+void SanbotUsbManager::recordFailure(EndpointSet& dev) {
+    dev.failCount++;
+    if (dev.failCount % 10 == 0) markForReopen(dev);
+}
 
-    vector<unsigned char> buf(512);
-    int transferred = 0;
-    int r = libusb_bulk_transfer(
-        dev.handle,
-        dev.inEp,
-        buf.data(),
-        static_cast<int>(buf.size()),
-        &transferred,
-        25
-    );
+void SanbotUsbManager::markForReopen(EndpointSet& dev) {
+    if (dev.reopen) return;
+    dev.reopen = true;
+    cancelTransfers(dev, true, true);
+    wakeEvents(dev);
+}
 
-    if (r == LIBUSB_ERROR_TIMEOUT || transferred <= 0) {
-        return false;
+void SanbotUsbManager::outTransferDone(libusb_transfer* transfer) {
+    OutTransfer& slot = *static_cast<OutTransfer*>(transfer->user_data);
+    EndpointSet& dev = *slot.dev;
+    SanbotUsbManager& self = *dev.owner;
+
+    lock_guard<mutex> lock(dev.mtx);
+    slot.busy = false;
+    dev.inFlight--;
+    if (transfer->status == LIBUSB_TRANSFER_COMPLETED && transfer->actual_length > 0) {
+        dev.failCount = 0;
+    } else if (transfer->status == LIBUSB_TRANSFER_NO_DEVICE) {
+        self.markForReopen(dev);
+    } else if (transfer->status != LIBUSB_TRANSFER_CANCELLED) {
+        self.recordFailure(dev);
     }
+    self.finishMessage(dev);
+    self.submitPending(dev);
+}
 
-    if (r < 0) {
-        dev.failCount++;
-        if (dev.failCount % 10 == 0) {
-            closeDevice(dev);
-            openDevice(dev, pid);
+// The read goes to the listener thread in its own buffer and the transfer is
+// queued again with a spare one.
+void SanbotUsbManager::inTransferDone(libusb_transfer* transfer) {
+    auto receivedAt = chrono::steady_clock::now();
+    InTransfer& slot = *static_cast<InTransfer*>(transfer->user_data);
+    EndpointSet& dev = *slot.dev;
+    SanbotUsbManager& self = *dev.owner;
+
+    lock_guard<mutex> lock(dev.mtx);
+    slot.busy = false;
+    dev.inFlight--;
+    if (transfer->status == LIBUSB_TRANSFER_COMPLETED) {
+        if (transfer->actual_length > 0) {
+            dev.failCount = 0;
+            if (self.listening) {
+                self.deliver(slot, static_cast<size_t>(transfer->actual_length),
+                             receivedAt);
+            }
         }
-        return false;
+    } else if (transfer->status == LIBUSB_TRANSFER_NO_DEVICE) {
+        self.markForReopen(dev);
+    } else if (transfer->status != LIBUSB_TRANSFER_CANCELLED &&
+               transfer->status != LIBUSB_TRANSFER_TIMED_OUT) {
+        self.recordFailure(dev);
     }
+    self.submitReceives(dev);
+    dev.transferCv.notify_all();
+}
 
-    dev.failCount = 0;
-    buf.resize(static_cast<size_t>(transferred));
-
-    UsbListener callback;
+// Called with the lane's mtx held. Without a spare buffer the read is dropped
+// and the transfer reads into the same buffer again.
+void SanbotUsbManager::deliver(InTransfer& slot, size_t length,
+                               chrono::steady_clock::time_point receivedAt) {
     {
-        lock_guard<mutex> lock(listenerMtx);
-        callback = listener;
+        lock_guard<mutex> lock(receivedMtx);
+        if (!delivering) return;
+        if (spareCount == 0) {
+            dropped++;
+            return;
+        }
+        ReceiveBuffer* filled = slot.buffer;
+        filled->size = length;
+        filled->pid = slot.dev->pid;
+        filled->receivedAt = receivedAt;
+        filled->refs = 1;
+        received[(receivedHead + receivedCount) % RECEIVE_BUFFERS] = filled;
+        receivedCount++;
+        slot.buffer = spareBuffers[--spareCount];
     }
-    if (callback) {
-        callback(pid, buf);
+    receivedCv.notify_one();
+}
+
+// Called with receivedMtx held.
+void SanbotUsbManager::releaseBuffer(ReceiveBuffer* buffer) {
+    if (--buffer->refs == 0) spareBuffers[spareCount++] = buffer;
+}
+
+SanbotUsbManager::RetainedRead SanbotUsbManager::retain(span<const uint8_t> data) {
+    lock_guard<mutex> lock(receivedMtx);
+    for (size_t i = 0; i < receiveBuffers.size(); ++i) {
+        ReceiveBuffer& buffer = receiveBuffers[i];
+        const uint8_t* begin = buffer.bytes.data();
+        if (buffer.refs > 0 && data.data() >= begin &&
+            data.data() < begin + buffer.size) {
+            buffer.refs++;
+            return RetainedRead(this, i);
+        }
     }
-    return true;
+    return RetainedRead();
+}
+
+size_t SanbotUsbManager::droppedReads() {
+    lock_guard<mutex> lock(receivedMtx);
+    return dropped;
+}
+
+SanbotUsbManager::RetainedRead::RetainedRead(RetainedRead&& other) noexcept
+    : owner(exchange(other.owner, nullptr)), index(other.index) {}
+
+SanbotUsbManager::RetainedRead&
+SanbotUsbManager::RetainedRead::operator=(RetainedRead&& other) noexcept {
+    if (this != &other) {
+        RetainedRead old(std::move(*this));
+        owner = exchange(other.owner, nullptr);
+        index = other.index;
+    }
+    return *this;
 }
 
-void SanbotUsbManager::openDevice(EndpointSet& dev, uint16_t pid) {
+SanbotUsbManager::RetainedRead::~RetainedRead() {
+    if (!owner) return;
+    lock_guard<mutex> lock(owner->receivedMtx);
+    owner->releaseBuffer(&owner->receiveBuffers[index]);
+}
+
+uint16_t SanbotUsbManager::RetainedRead::pid() const {
+    return owner ? owner->receiveBuffers[index].pid : 0;
+}
+
+span<const uint8_t> SanbotUsbManager::RetainedRead::bytes() const {
+    if (!owner) return {};
+    const ReceiveBuffer& buffer = owner->receiveBuffers[index];
+    return {buffer.bytes.data(), buffer.size};
+}
+
+chrono::steady_clock::time_point SanbotUsbManager::RetainedRead::receivedAt() const {
+    return owner ? owner->receiveBuffers[index].receivedAt
+                 : chrono::steady_clock::time_point{};
+}
+
+void SanbotUsbManager::openDevice(EndpointSet& dev) {
     closeDevice(dev);
 
     libusb_device** list = nullptr;
-    ssize_t cnt = libusb_get_device_list(ctx, &list);
+    ssize_t cnt = libusb_get_device_list(dev.ctx, &list);
     if (cnt < 0) return;
 
     for (ssize_t i = 0; i < cnt; ++i) {
         libusb_device* device = list[i];
         libusb_device_descriptor desc;
         if (libusb_get_device_descriptor(device, &desc) != 0) continue;
-        if (desc.idVendor != VID || desc.idProduct != pid) continue;
+        if (desc.idVendor != VID || desc.idProduct != dev.pid) continue;
 
         libusb_device_handle* handle = nullptr;
         if (libusb_open(device, &handle) != 0 || !handle) continue;
@@ -326,13 +607,30 @@ void SanbotUsbManager::closeDevice(EndpointSet& dev) {
     dev.inEp = 0;
     dev.iface = -1;
     dev.failCount = 0;
+    dev.reopen = false;
 }
 
-void SanbotUsbManager::notifyIdle() {
-    queueEmptyCv.notify_all();
+void SanbotUsbManager::finishMessage(EndpointSet& dev) {
+    if (dev.activeMessages.fetch_sub(1) == 1) dev.activeMessages.notify_all();
+}
+
+void SanbotUsbManager::wakeEvents(EndpointSet& dev) {
+    libusb_interrupt_event_handler(dev.ctx);
+}
+
+void SanbotUsbManager::waitForLane(EndpointSet& dev) {
+    size_t active;
+    while ((active = dev.activeMessages.load()) != 0) {
+        dev.activeMessages.wait(active);
+    }
 }
 
 void SanbotUsbManager::waitForPendingSends() {
-    unique_lock<mutex> lock(mtx);
-    queueEmptyCv.wait(lock, [&] { return msgQueue.empty() && activeMessages == 0; });
+    waitForLane(head);
+    waitForLane(bottom);
+}
+
+void SanbotUsbManager::waitForPendingSends(uint16_t pid) {
+    if (pid == PID_HEAD) waitForLane(head);
+    if (pid == PID_BOTTOM) waitForLane(bottom);
 }
@@ -1,11 +1,16 @@
 #pragma once
 
+#include "frame.h"
+#include "frame-ring.h"
+
+#include <array>
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <cstdint>
 #include <functional>
 #include <mutex>
-#include <queue>
+#include <span>
 #include <thread>
 #include <vector>
 
@@ -18,10 +23,25 @@ struct libusb_config_descriptor;
 struct libusb_interface;
 struct libusb_interface_descriptor;
 struct libusb_endpoint_descriptor;
+struct libusb_transfer;
 
+// Talks to the head and bottom MCUs through libusb's asynchronous API. Each
+// device is an independent lane with its own libusb context, event thread,
+// lock and ring of outgoing frames, so frames keep their order per device
+// only and a slow or stalled device never delays the other. Senders only push
+// into the lane's ring, without taking its lock, and interrupt the event
+// thread only when it is parked waiting for work. A lane keeps up to
+// OUT_TRANSFERS frames in flight and completions submit the next one, so
+// sends pipeline. While listening, IN_TRANSFERS reads stay queued on each IN
+// endpoint, each reading into a buffer from a fixed pool. A completed read is
+// handed to a listener thread as it is, and its transfer continues with a
+// spare buffer, so a slow listener never delays a transfer and receiving
+// allocates nothing.
 class SanbotUsbManager {
 public:
-    using UsbListener = function<void(uint16_t pid, const vector<unsigned char>& data)>;
+    // data is lent for the duration of the call only; retain() keeps it.
+    using UsbListener = function<void(uint16_t pid, span<const uint8_t> data,
+                                      chrono::steady_clock::time_point receivedAt)>;
 
     static constexpr uint16_t VID = 0x0483;
     static constexpr uint16_t PID_BOTTOM = 0x5740;
@@ -29,59 +49,179 @@ public:
 
     static constexpr int WHAT_SEND_TO_HEAD   = 0x01;
     static constexpr int WHAT_SEND_TO_BOTTOM = 0x02;
-    static constexpr int WHAT_SEND_TO_POINT  = 0x04;
+    static constexpr int WHAT_SEND_TO_BOTH   = 0x03;
+
+    // Frames a lane holds before senders wait for it to drain.
+    static constexpr size_t SEND_QUEUE_SIZE = 256;
+    static constexpr size_t OUT_TRANSFERS = 4;
+    static constexpr size_t IN_TRANSFERS = 2;
+    static constexpr size_t IN_BUFFER_SIZE = 512;
+    // Shared by both devices' reads, queued, in-flight and retained.
+    static constexpr size_t RECEIVE_BUFFERS = 32;
+    // A send the device has not taken by then is counted as failed.
+    static constexpr unsigned OUT_TIMEOUT_MS = 1000;
 
     SanbotUsbManager();
     ~SanbotUsbManager();
 
-    void sendToHead(const vector<unsigned char>& frame);
-    void sendToBottom(const vector<unsigned char>& frame);
-    void sendToPoint(const vector<unsigned char>& routedFrameWithTag);
+    void sendToHead(Frame frame);
+    void sendToBottom(Frame frame);
+    // Route tags are 0x01 head, 0x02 bottom, 0x03 both; frames with any
+    // other tag are dropped and sendRouted returns false.
+    bool sendRouted(Frame frame, uint8_t routeTag);
+    void sendToPoint(Frame routedFrameWithTag);
     void waitForPendingSends();
+    // Waits for one device's lane only.
+    void waitForPendingSends(uint16_t pid);
     bool takeControl();
     void setListener(UsbListener callback);
     void startListener();
+    // No listener call is running or made once this returns. A listener may
+    // call it (or startListener) too; it then returns without waiting for the
+    // call it is made from, and unless restarted no further calls follow.
     void stopListener();
 
+    // A read kept past its listener call. Its buffer goes back to the pool
+    // when this is destroyed, so it must not outlive the manager; while all
+    // spare buffers are retained, new reads are dropped.
+    class RetainedRead {
+    public:
+        RetainedRead() = default;
+        RetainedRead(RetainedRead&& other) noexcept;
+        RetainedRead& operator=(RetainedRead&& other) noexcept;
+        ~RetainedRead();
+
+        explicit operator bool() const { return owner != nullptr; }
+        uint16_t pid() const;
+        span<const uint8_t> bytes() const;
+        chrono::steady_clock::time_point receivedAt() const;
+
+    private:
+        friend class SanbotUsbManager;
+        RetainedRead(SanbotUsbManager* owner, size_t index)
+            : owner(owner), index(index) {}
+
+        SanbotUsbManager* owner = nullptr;
+        size_t index = 0;
+    };
+
+    // Keeps the buffer behind data, which must be what a listener call is
+    // being given; otherwise the result is empty.
+    RetainedRead retain(span<const uint8_t> data);
+    // Reads dropped because no spare buffer was left.
+    size_t droppedReads();
+
 private:
+    struct EndpointSet;
+
+    struct OutTransfer {
+        EndpointSet* dev = nullptr;
+        libusb_transfer* transfer = nullptr;
+        Frame data;
+        bool busy = false;
+    };
+
+    // refs counts the listener call and retained reads holding a buffer
+    // that has been handed out.
+    struct ReceiveBuffer {
+        array<uint8_t, IN_BUFFER_SIZE> bytes{};
+        size_t size = 0;
+        uint16_t pid = 0;
+        chrono::steady_clock::time_point receivedAt;
+        int refs = 0;
+    };
+
+    struct InTransfer {
+        EndpointSet* dev = nullptr;
+        libusb_transfer* transfer = nullptr;
+        ReceiveBuffer* buffer = nullptr;
+        bool busy = false;
+    };
+
+    // One device's lane. Any thread may push into pending, but only the event
+    // thread pops from it, bumping freedSlots for senders waiting on a full
+    // ring. parked is set while the event thread waits with nothing to
+    // submit, and activeMessages counts frames queued or in flight; waiters
+    // sleep on it directly. mtx guards everything after them; reopen
+    // marks the device to be closed and opened again once its transfers have
+    // been cancelled and completed.
     struct EndpointSet {
+        SanbotUsbManager* owner = nullptr;
+        uint16_t pid = 0;
+        libusb_context* ctx = nullptr;
+        thread eventWorker;
+        FrameRing<SEND_QUEUE_SIZE> pending;
+        atomic<uint32_t> freedSlots{0};
+        atomic<bool> parked{false};
+        atomic<size_t> activeMessages{0};
+        mutex mtx;
+        condition_variable transferCv;
         libusb_device_handle* handle = nullptr;
         uint8_t outEp = 0;
         uint8_t inEp  = 0;
         int iface = -1;
         int failCount = 0;
+        bool reopen = false;
+        array<OutTransfer, OUT_TRANSFERS> out;
+        array<InTransfer, IN_TRANSFERS> in;
+        size_t inFlight = 0;
     };
 
-    struct Message {
-        int what;
-        vector<unsigned char> data;
-    };
-
-    libusb_context* ctx = nullptr;
     EndpointSet bottom;
     EndpointSet head;
 
-    thread worker;
-    thread listenerWorker;
-    mutex mtx;
-    mutex usbMtx;
     mutex listenerMtx;
-    condition_variable cv;
-    condition_variable queueEmptyCv;
-    queue<Message> msgQueue;
-    size_t activeMessages = 0;
     atomic<bool> running{false};
     atomic<bool> listening{false};
     UsbListener listener;
+    // Bumped by setListener so the listener thread copies the callback only
+    // when it changes.
+    atomic<uint64_t> listenerGeneration{0};
+
+    // receivedMtx guards the pool and the reads waiting for the listener
+    // thread, a ring over the same number of slots; delivering is cleared to
+    // stop the thread. A lane's mtx may be held when taking it, never the
+    // other way round.
+    thread listenerWorker;
+    mutex receivedMtx;
+    condition_variable receivedCv;
+    array<ReceiveBuffer, RECEIVE_BUFFERS> receiveBuffers;
+    array<ReceiveBuffer*, RECEIVE_BUFFERS> spareBuffers{};
+    size_t spareCount = 0;
+    array<ReceiveBuffer*, RECEIVE_BUFFERS> received{};
+    size_t receivedHead = 0;
+    size_t receivedCount = 0;
+    size_t dropped = 0;
+    bool delivering = false;
+
+    static_assert(RECEIVE_BUFFERS > 2 * IN_TRANSFERS,
+                  "every IN transfer needs a buffer and a spare");
+
+    static void outTransferDone(libusb_transfer* transfer);
+    static void inTransferDone(libusb_transfer* transfer);
 
-    void enqueueMessage(int what, const vector<unsigned char>& data);
-    void sendLoop();
+    void enqueueMessage(int what, Frame data);
+    void queueFrame(EndpointSet& dev, Frame data);
+    void eventLoop(EndpointSet& dev);
+    void serviceDevice(EndpointSet& dev);
+    void submitPending(EndpointSet& dev);
+    bool popFrame(EndpointSet& dev, Frame& frame);
+    bool canSubmit(const EndpointSet& dev) const;
+    void submitReceives(EndpointSet& dev);
+    void cancelTransfers(EndpointSet& dev, bool outgoing, bool incoming);
+    void recordFailure(EndpointSet& dev);
+    void markForReopen(EndpointSet& dev);
+    void finishMessage(EndpointSet& dev);
+    void stopReceiving(EndpointSet& dev);
+    void deliver(InTransfer& slot, size_t length,
+                 chrono::steady_clock::time_point receivedAt);
+    void releaseBuffer(ReceiveBuffer* buffer);
     void listenLoop();
-    void handlePointMessage(const vector<unsigned char>& buffers);
-    void sendBufferTo(EndpointSet& dev, uint16_t pid, const vector<unsigned char>& buf);
-    bool pollEndpoint(EndpointSet& dev, uint16_t pid);
-    void openDevice(EndpointSet& dev, uint16_t pid);
+    void waitForLane(EndpointSet& dev);
+    void initLane(EndpointSet& dev, uint16_t pid);
+    void freeLane(EndpointSet& dev);
+    void openDevice(EndpointSet& dev);
     void closeDevice(EndpointSet& dev);
     bool claimInterface(libusb_device_handle* handle, int iface);
-    void notifyIdle();
+    void wakeEvents(EndpointSet& dev);
 };